@@ -47,8 +47,8 @@ void* lane_detection_loop(void* detector_ptr)
 }
 
 LaneDetector::LaneDetector() : running(true), median_blur_radius(25), rosnode(ros::NodeHandle()),
-        canny_grad_thresh(80), canny_cont_thresh(40), hough_radius_inc(10),
-        hough_theta_inc(4.0 * CV_PI / 180.0), hough_min_votes(400)
+        canny_grad_thresh(80), canny_cont_thresh(30), hough_radius_inc(10),
+        hough_theta_inc(4.0 * CV_PI / 180.0), hough_min_votes(300)
 {
     laneimg_listener = rosnode.subscribe("/color/image_raw", 1, img_listener);
 
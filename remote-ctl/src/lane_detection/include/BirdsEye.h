@@ -0,0 +1,79 @@
+#ifndef __BIRDS_EYE__
+#define __BIRDS_EYE__
+
+#include <vector>
+#include "opencv2/core.hpp"
+#include "RoadRegion.h"
+#include "StageClock.h"
+
+#define BEV_WINDOWS 9            ///< sliding windows stacked over the height of the top down view
+#define BEV_MIN_WINDOW_PIXELS 15 ///< edge pixels a window needs to count as part of a line and recenter the next window
+#define BEV_MIN_LINE_WINDOWS 3   ///< windows a line has to be found in before a polynomial is fitted to it
+
+/// Calibration of the top down view. The ground trapezoid is the part of the
+/// image showing a view_width by view_length rectangle of flat road straight
+/// ahead of the car, so it depends only on how the camera is mounted.
+struct BirdsEyeConfig
+{
+    struct RoadRegionConfig ground; ///< image trapezoid warped onto the whole top down view
+    double view_width;              ///< meters covered by the bottom edge of the trapezoid
+    double view_length;             ///< meters from the bottom to the top edge of the trapezoid
+    int warp_width;                 ///< top down view size in pixels
+    int warp_height;
+    int window_margin;              ///< half width of the sliding windows in top down pixels
+};
+
+/// Lane lines fitted in the top down view. Each line is a polynomial
+/// x = c[0] + c[1] * s + c[2] * s^2 giving the lateral position x in meters
+/// from the left edge of the view, s meters ahead of its bottom edge.
+struct LaneFit
+{
+    cv::Vec3d left;
+    cv::Vec3d right;
+    int left_windows;     ///< sliding windows the left line was found in
+    int right_windows;    ///< sliding windows the right line was found in
+    bool found;           ///< both lines were fitted and do not cross
+    double center_offset; ///< meters the car is right of the lane center
+    double heading;       ///< direction of the lane at the car in radians, positive when it heads right
+    double curvature;     ///< curvature of the lane at the car in 1/m, positive when it bends right
+    double confidence;
+};
+
+/// Lane engine that warps the road to a top down view and fits a polynomial
+/// to each lane line. The warp is a remap table built the first time a
+/// frame size is seen, so each frame costs one pass over the view.
+class BirdsEye
+{
+private:
+    struct BirdsEyeConfig config;
+    cv::Size image_size; ///< image size the remap table was built for
+    cv::Mat map_xy;      ///< fixed point image position of every top down pixel
+    cv::Mat map_frac;    ///< interpolation weights belonging to map_xy
+    double car_x;        ///< meters from the left edge of the view to the car
+
+    cv::Mat warped;
+    cv::Mat warped_gray;
+    cv::Mat edges;
+    cv::Mat histogram;
+    std::vector<cv::Rect> windows; ///< sliding windows of the latest frame
+    std::vector<double> ss;        ///< forward and lateral meters of the pixels found for one line
+    std::vector<double> xs;
+
+    void build_maps(const cv::Size& size);
+    int find_base(int begin, int end) const;
+    int slide_windows(int base);
+    bool fit_line(cv::Vec3d& coeffs) const;
+
+public:
+    BirdsEye();
+
+    void configure(const struct BirdsEyeConfig& config);
+    const struct BirdsEyeConfig& get_config() const;
+    bool detect(const cv::Mat& img, double canny_low, double canny_high, struct LaneFit& fit,
+                StageClock* clock = NULL);
+    const cv::Mat& get_edges() const;
+    void draw(cv::Mat& img, const struct LaneFit& fit) const;
+    int offset_pixels(double meters, int image_width) const;
+};
+
+#endif
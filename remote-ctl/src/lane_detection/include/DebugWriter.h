@@ -0,0 +1,63 @@
+#ifndef __DEBUG_WRITER__
+#define __DEBUG_WRITER__
+
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include "opencv2/core.hpp"
+
+#define DEBUG_WRITER_DEFAULT_QUEUE 4 ///< sampled frames waiting to be written before new ones are dropped
+
+/// Counters of a DebugWriter
+struct DebugWriterStats
+{
+    unsigned long queued;  ///< sampled frames handed to the writer thread
+    unsigned long written; ///< frames written to disk
+    unsigned long dropped; ///< sampled frames discarded because the queue was full
+};
+
+/// Copy of the images of one sampled frame waiting to be written
+struct DebugImages
+{
+    unsigned long stamp_ms; ///< wall clock time the frame was queued. used in the file names
+    unsigned long sequence; ///< frame pool sequence number of the frame. used in the file names
+    std::string stream;     ///< camera the frame came from in multi-camera mode, with / replaced by _. empty otherwise
+    cv::Mat img;
+    cv::Mat edges;
+};
+
+/// Writes debug images of sampled frames from a background thread. Frames
+/// are sampled every Nth sequence number or when their confidence is low.
+/// Sampled images are copied into a bounded ring of preallocated slots and
+/// JPEG encoding and disk I/O happen on the writer thread only. When the ring
+/// is full the frame is dropped instead of waiting for the disk.
+class DebugWriter
+{
+    friend void* debug_writer_loop(void* writer_ptr);
+
+private:
+    std::string directory;
+    int every_n;           ///< sample every Nth frame. 0 never samples by count
+    double min_confidence; ///< also sample frames below this confidence. 0 never samples by confidence
+
+    std::vector<struct DebugImages> slots;
+    int head;              ///< oldest queued slot. guarded by queue_lock
+    int count;             ///< queued slots. guarded by queue_lock
+    bool running;
+    struct DebugWriterStats stats;
+
+    pthread_mutex_t queue_lock;
+    pthread_cond_t frame_queued;
+    pthread_t writer_thread;
+
+public:
+    DebugWriter(const std::string& directory, int every_n, double min_confidence,
+                int queue_size = DEBUG_WRITER_DEFAULT_QUEUE);
+    ~DebugWriter();
+
+    bool sampled(unsigned long sequence, double confidence) const;
+    bool submit(const cv::Mat& img, const cv::Mat& edges, unsigned long sequence, const std::string& stream = "");
+    struct DebugWriterStats get_stats();
+};
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef __FRAME_POOL__
+#define __FRAME_POOL__
+
+#include <pthread.h>
+#include <time.h>
+#include <vector>
+#include "opencv2/core.hpp"
+
+#define FRAME_POOL_DEFAULT_SIZE 3 ///< triple buffer: one being written, one published, one being processed
+
+/// One preallocated frame buffer owned by a FramePool. The image buffer is
+/// reused for every frame of the same size and type so steady state
+/// ingestion does not touch the heap.
+struct FrameSlot
+{
+    cv::Mat image;            ///< frame pixels
+    unsigned long sequence;   ///< sequence number assigned when the frame was committed
+    struct timespec received; ///< CLOCK_MONOTONIC time the frame was committed
+    unsigned long long stamp_ns; ///< capture time given by the frame's source in ns since the epoch. set by the writer, 0 if unknown
+    int refs;                 ///< outstanding writers and handles. guarded by FramePool.pool_lock
+};
+
+/// Frame counters for a FramePool
+struct FramePoolStats
+{
+    unsigned long committed;   ///< frames written into the pool
+    unsigned long dropped;     ///< frames discarded because every slot was in use
+    unsigned long overwritten; ///< frames replaced by a newer frame before anyone read them
+    unsigned long stale;       ///< frames skipped by wait_newer() for exceeding the maximum age
+};
+
+class FramePool;
+
+/// Reference counted handle to a frame in a FramePool. The slot is handed
+/// back to the pool when the handle is released or destroyed.
+class FrameHandle
+{
+private:
+    FramePool* pool;
+    FrameSlot* slot;
+
+public:
+    FrameHandle();
+    FrameHandle(FramePool* pool, FrameSlot* slot);
+    FrameHandle(FrameHandle&& other);
+    FrameHandle& operator=(FrameHandle&& other);
+    FrameHandle(const FrameHandle&) = delete;
+    FrameHandle& operator=(const FrameHandle&) = delete;
+    ~FrameHandle();
+
+    void release();
+
+    const FrameSlot* operator->() const { return slot; }
+    const FrameSlot& operator*() const { return *slot; }
+    explicit operator bool() const { return slot != NULL; }
+};
+
+/// Fixed pool of frame slots shared by a single producer (the image
+/// listener) and any number of readers. Readers always get the most recent
+/// frame; slots are recycled once no handle references them.
+class FramePool
+{
+    friend class FrameHandle;
+
+private:
+    std::vector<FrameSlot> slots;
+    FrameSlot* latest;    ///< most recently committed slot. NULL until the first frame
+    bool latest_consumed; ///< whether a reader has acquired the latest slot
+    unsigned long next_sequence;
+    struct FramePoolStats stats;
+
+    pthread_mutex_t pool_lock;
+    pthread_cond_t frame_ready; ///< signalled on every commit. waits use CLOCK_MONOTONIC
+
+    void release(FrameSlot* slot);
+
+public:
+    explicit FramePool(int size = FRAME_POOL_DEFAULT_SIZE);
+    ~FramePool();
+
+    FrameSlot* begin_write();
+    void commit_write(FrameSlot* slot);
+    void abort_write(FrameSlot* slot);
+
+    FrameHandle acquire_latest();
+    FrameHandle wait_newer(unsigned long after_sequence, int timeout_ms, int max_age_ms = 0);
+    FrameHandle take_newer(unsigned long& after_sequence, int max_age_ms = 0);
+    bool has_newer(unsigned long after_sequence);
+    struct FramePoolStats get_stats();
+};
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef __FRAME_RECORDING__
+#define __FRAME_RECORDING__
+
+#include <stdint.h>
+#include <string>
+#include "opencv2/core.hpp"
+
+#define RECORDING_MAGIC "LANEREC"  ///< first bytes of a recording file
+#define RECORDING_VERSION 1
+#define RECORDING_ALIGN 64         ///< frames start on cache line boundaries
+#define RECORDING_DEFAULT_MB 1024  ///< file size reserved by a recorder by default
+#define RECORDING_DEFAULT_FRAMES 65536 ///< index entries reserved by a recorder by default
+
+/// Start of a recording file. The index follows it, then the pixel data
+struct RecordingHeader
+{
+    char magic[8];       ///< RECORDING_MAGIC
+    uint32_t version;
+    uint32_t max_frames; ///< index entries reserved after the header
+    uint64_t frames;     ///< index entries in use. raised only once a frame is complete
+    uint64_t data_end;   ///< file offset where the next frame goes
+};
+
+/// Index entry of one recorded frame
+struct RecordedFrame
+{
+    uint64_t stamp_ns; ///< capture time in ns since the epoch. 0 if unknown
+    uint64_t sequence; ///< frame pool sequence number the frame was committed with
+    uint64_t offset;   ///< file offset of the first pixel row. rows follow each other without padding
+    uint32_t encoding; ///< OpenCV pixel type: CV_8UC3 for bgr8 frames, CV_8UC1 for mono8 luma frames
+    uint16_t rows;
+    uint16_t cols;
+    uint16_t stream;   ///< camera index in multi-camera mode, otherwise 0
+    uint16_t reserved;
+    uint32_t reserved2;
+};
+
+/// Counters of a FrameRecorder
+struct RecordingStats
+{
+    unsigned long recorded; ///< frames in the recording
+    unsigned long dropped;  ///< frames that did not fit
+    unsigned long bytes;    ///< file size once the recorder is closed
+};
+
+/// Appends frames to a file mapped into memory. The whole file is
+/// allocated up front, so recording a frame is one copy into the mapping
+/// with no system call, and a frame that does not fit is dropped rather
+/// than growing the file. The file is cut down to what was recorded when
+/// the recorder is destroyed. One thread may append at a time.
+class FrameRecorder
+{
+private:
+    std::string path;
+    int fd;
+    uint8_t* base;      ///< the mapped file
+    uint64_t capacity;  ///< bytes mapped
+    struct RecordingHeader* header;
+    struct RecordedFrame* index;
+    unsigned long dropped;
+
+public:
+    FrameRecorder(const std::string& path, uint64_t capacity, uint32_t max_frames = RECORDING_DEFAULT_FRAMES);
+    ~FrameRecorder();
+
+    bool append(const cv::Mat& image, unsigned long sequence, unsigned long long stamp_ns, int stream = 0);
+    struct RecordingStats get_stats() const;
+};
+
+/// Read-only view of a recording. Frames are cv::Mat headers pointing
+/// straight into the mapping, so reading one copies nothing. They must not
+/// be written to and must not outlive the FrameReplay.
+class FrameReplay
+{
+private:
+    int fd;
+    const uint8_t* base;
+    uint64_t length;
+    const struct RecordingHeader* header;
+    const struct RecordedFrame* index;
+
+public:
+    explicit FrameReplay(const std::string& path);
+    ~FrameReplay();
+
+    size_t size() const;
+    const struct RecordedFrame& entry(size_t frame) const;
+    cv::Mat image(size_t frame) const;
+};
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef __FRAME_SOURCE__
+#define __FRAME_SOURCE__
+
+#include <string>
+#include <vector>
+#include "opencv2/core.hpp"
+
+bool load_frames(const std::string& path, std::vector<cv::Mat>& frames, int max_width = 0, int max_frames = 0);
+
+#endif
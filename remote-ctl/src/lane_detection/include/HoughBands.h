@@ -0,0 +1,106 @@
+#ifndef __HOUGH_BANDS__
+#define __HOUGH_BANDS__
+
+#include <vector>
+#include <cstdint>
+#include "opencv2/core.hpp"
+#include "WorkerPool.h"
+
+#define HOUGH_MIN_POINTS_PER_THREAD 1024 ///< below this many edge points per thread extra threads cost more than they save
+#define HOUGH_MAX_COORD INT16_MAX        ///< edge pixel coordinates, offset included, are stored in 16 bits
+#define HOUGH_FIXED_BITS 24              ///< most fraction bits of the fixed-point trig tables. large frames get fewer
+#define LANE_THETA_MIN (7.0 * CV_PI / 180.0)      ///< lines closer to vertical than this are not lane edges
+#define LANE_THETA_MAX (173.0 * CV_PI / 180.0)
+#define LANE_THETA_GAP_MIN (80.0 * CV_PI / 180.0) ///< lines closer to horizontal than this are not lane edges
+#define LANE_THETA_GAP_MAX (100.0 * CV_PI / 180.0)
+
+/// Open interval of Hough angles that is voted on
+struct ThetaBand
+{
+    double min; ///< radians
+    double max; ///< radians
+};
+
+/**
+ * Whether a Hough line angle can belong to a lane marker. Near horizontal
+ * and near vertical lines are never lane edges from the car's viewpoint.
+ */
+inline bool is_lane_angle(double theta)
+{
+    return (theta > LANE_THETA_MIN) && (theta < LANE_THETA_MAX) &&
+           ((theta < LANE_THETA_GAP_MIN) || (theta > LANE_THETA_GAP_MAX));
+}
+
+const std::vector<struct ThetaBand>& lane_theta_bands();
+
+/// Hough line transform that only votes over selected angle bands and a
+/// selected radius range. Angles lie on multiples of the theta step, like
+/// cv::HoughLines, so results are interchangeable with it.
+class HoughBands
+{
+private:
+    std::vector<struct ThetaBand> bands;
+    double radius_min; ///< radius of accumulator column 0
+    double radius_inc;
+    double theta_inc;
+    int num_radii;
+    int stride;        ///< accumulator row length: num_radii plus a guard column on each side
+
+    std::vector<double> row_thetas; ///< angle of each accumulator row. guard rows are negative
+    std::vector<int> vote_rows;     ///< rows that are voted on, i.e. all but the guard rows
+    std::vector<float> cos_table;   ///< cos(theta) / radius_inc per row
+    std::vector<float> sin_table;   ///< sin(theta) / radius_inc per row
+    std::vector<int32_t> cos_fixed; ///< cos_table with fixed_bits fraction bits
+    std::vector<int32_t> sin_fixed;
+    int32_t offset_fixed;           ///< radius offset of column 0 plus rounding, with fixed_bits fraction bits
+    int fixed_bits;
+    int fixed_extent;               ///< largest coordinate the fixed-point tables are scaled for. 0 before the first points
+    bool fixed_point;               ///< vote with the fixed-point tables instead of float
+    std::vector<int> accumulator;
+
+    std::vector<int16_t> xs;        ///< compacted edge pixel coordinates, or the pixels that appeared since the previous frame
+    std::vector<int16_t> ys;
+    std::vector<int16_t> gone_xs;   ///< pixels that disappeared since the previous frame
+    std::vector<int16_t> gone_ys;
+
+    cv::Mat previous_edges;         ///< edge map the accumulator currently holds the votes of
+    cv::Point previous_offset;
+    bool accumulator_valid;         ///< false whenever the accumulator no longer matches previous_edges
+    int frames_since_rebuild;
+    int edge_points;                ///< edge pixels in previous_edges
+    int points_voted;               ///< points voted on by the latest update
+
+    WorkerPool* pool;
+    int num_threads;
+    std::vector<std::vector<int> > radius_index;          ///< per thread scratch space for one row of votes
+    std::vector<std::vector<int> > worker_accumulators;  ///< private accumulators of threads 1..n. thread 0 votes in place
+
+    void vote_row(int row, const int16_t* x, const int16_t* y, int count, int weight, int* acc, int* index);
+    void accumulate(const int16_t* x, const int16_t* y, int count, int weight, bool clear);
+    void accumulate_parallel(const int16_t* x, const int16_t* y, int count, int weight, bool clear, int threads);
+    void clear_guards();
+    void build_fixed_tables(int extent);
+    void set_extent(const cv::Mat& edges, const cv::Point& offset);
+    void collect_changes(const cv::Mat& edges);
+
+public:
+    HoughBands();
+
+    void configure(const std::vector<struct ThetaBand>& bands,
+                   double radius_min, double radius_max,
+                   double radius_inc, double theta_inc);
+    void set_parallel(WorkerPool* pool, int num_threads);
+    void set_fixed_point(bool enabled);
+    void collect_points(const cv::Mat& edges, const cv::Point& offset = cv::Point(0, 0));
+    void vote();
+    void find_lines(int min_votes, std::vector<cv::Vec2d>& lines) const;
+    void detect(const cv::Mat& edges, const cv::Point& offset, int min_votes, std::vector<cv::Vec2d>& lines);
+    bool update(const cv::Mat& edges, const cv::Point& offset, int rebuild_interval);
+    void detect_incremental(const cv::Mat& edges, const cv::Point& offset, int min_votes,
+                            int rebuild_interval, std::vector<cv::Vec2d>& lines);
+
+    int num_points() const;
+    int num_points_voted() const;
+};
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef __HOUGH_REFINE__
+#define __HOUGH_REFINE__
+
+#include <vector>
+#include "opencv2/core.hpp"
+
+#define REFINE_THETA_DIVISIONS 4 ///< refinement theta step is the coarse theta step divided by this
+
+cv::Rect line_band_rect(const cv::Size& size, const cv::Vec2d& line, int band);
+void draw_line_band(cv::Mat& mask, const cv::Vec2d& line, int band);
+cv::Vec2d refine_hough_line(const std::vector<cv::Point>& points,
+                            const cv::Point& offset,
+                            const cv::Vec2d& line,
+                            int band,
+                            double theta_span,
+                            double theta_step,
+                            int* votes = NULL);
+
+#endif
@@ -0,0 +1,181 @@
+#ifndef __LANE_CORE__
+#define __LANE_CORE__
+
+#include <cstdio>
+#include <cmath>
+#include <vector>
+#include <string>
+#include "opencv2/core.hpp"
+#include "RoadRegion.h"
+#include "PreFilter.h"
+#include "StageClock.h"
+#include "HoughBands.h"
+#include "WorkerPool.h"
+#include "LaneTracker.h"
+#include "BirdsEye.h"
+#include "StripEdges.h"
+
+#define TRACK_STRIP_ROWS 32  ///< rows per strip filtered along a tracked line
+#define TRACK_STRIP_MARGIN 4 ///< extra pixels filtered around each strip so blur and Canny borders are discarded
+#define LANE_MAX_HOUGH_THREADS 64 ///< most threads hough_threads may split voting over
+
+struct LanePose
+{
+    int center_offset; ///< car's offset from center in pixels
+    double heading;    ///< lane direction relative to the car in radians, positive to the right. 0 if unknown
+    double curvature;  ///< lane curvature ahead of the car in 1/m, positive bending right. 0 if unknown
+    double confidence; ///< confidence that a lane has actually be detected
+};
+
+/// Ways of finding the lane in a frame
+enum LaneEngine
+{
+    LANE_ENGINE_HOUGH,     ///< straight lines on the perspective image
+    LANE_ENGINE_BIRDS_EYE, ///< polynomial fit on a top down view. provides heading and curvature
+    NUM_LANE_ENGINES
+};
+
+extern const char* LANE_ENGINE_NAMES[NUM_LANE_ENGINES];
+
+/// Overlay line drawn onto the debug edge image of a sampled frame
+struct DebugLine
+{
+    cv::Point from;
+    cv::Point to;
+    int thickness;
+};
+
+/// Filters and transforms that keep buffers and caches between frames. Every
+/// thread detecting lanes at the same time needs its own set.
+struct LaneFilters
+{
+    PreFilter prefilter;    ///< noise filter run before Canny
+    StripEdges strip_edges; ///< strip-tiled gray, pre-filter and Canny used when strip_rows is set
+    HoughBands hough;       ///< lane angle band Hough transform
+    RoadRegion road_region; ///< where the road can be in the image
+    BirdsEye birds_eye;     ///< top down lane engine
+};
+
+/// Pre-filtered road region of one recorded frame and what producing it cost
+struct PrefilteredFrame
+{
+    cv::Mat gray;   ///< empty until a run filled it
+    double gray_ms;
+    double blur_ms;
+};
+
+/// Pre-filtered road regions of a recorded frame set, shared by runs whose
+/// settings only differ past the pre-filter. Only the run with filling set
+/// stores frames, the others only read them, so runs can share a cache
+/// across threads once the filling run is done.
+struct PrefilterCache
+{
+    std::vector<struct PrefilteredFrame> frames; ///< indexed by frame sequence number - 1
+    bool filling;
+};
+
+/// Tuning of the lane core. Every frame is detected with one LaneParams from
+/// start to end; the node swaps in a new immutable copy when a parameter
+/// changes instead of writing to the one frames are reading.
+struct LaneParams
+{
+    int canny_grad_thresh; ///< gradient threshold needed to start a canny edge
+    int canny_cont_thresh; ///< gredient threshold needed to continue a canny edge
+    int hough_radius_inc;  ///< radius step size for Hough transform
+    double hough_theta_inc; ///< theta step size for Hough transform
+    int hough_min_votes;   ///< minimum number of votes needed to detect a Hough line
+    int hough_threads;     ///< threads Hough voting is split over, including the detection thread
+    int hough_rebuild_interval; ///< frames between full Hough votes, voting only changed edge pixels in between. 0 always votes in full
+    bool hough_fixed_point; ///< compute Hough vote radii in fixed point instead of float
+    int strip_rows;        ///< rows per strip of the tiled gray, pre-filter and Canny pass. 0 runs each stage over the whole road region
+    int working_width;     ///< width of the coarse detection pass. 0 or >= frame width detects at full resolution only
+    int refine_band;       ///< half width in full resolution pixels of the band searched around each coarse line
+    bool track_lanes;      ///< follow the lane lines across frames and only search around their predicted position
+    int track_band;        ///< half width in reference width pixels of the band searched around a predicted line
+    double track_theta_span; ///< angle searched either side of a predicted line
+    int track_min_votes;   ///< votes at reference width a tracked line needs to count as found
+    double track_min_confidence; ///< detections below this confidence reset tracking and searches fall back to the whole frame
+    enum LaneEngine lane_engine; ///< how lanes are found
+    enum PreFilterKind prefilter_kind; ///< noise filter run before Canny. change with set_prefilter()
+    int prefilter_size;    ///< pre-filter kernel size at LANE_REFERENCE_WIDTH. change with set_prefilter()
+    int qos_level;         ///< quality of service level the tuning was degraded to. 0 is the configured tuning
+
+    LaneParams();
+
+    bool set_lane_engine(const std::string& name);
+    void set_hough_theta_inc(double inc);
+    bool set_prefilter(enum PreFilterKind kind, int size);
+    bool set_option(const std::string& name, const std::string& value);
+    bool load_config(const std::string& path, int point);
+};
+
+/// Buffers and results of one frame on its way through the detector. In
+/// the node's pipelined mode a fixed set of them circulates between the
+/// stage threads, so steady state processing does not allocate.
+struct LaneWorkspace
+{
+    unsigned long sequence; ///< frame pool sequence number of the frame
+    unsigned long long stamp_ns; ///< capture time of the frame in ns since the epoch. 0 if unknown
+    cv::Mat img_color;      ///< resized working copy of the frame. BGR, or single channel in luma mode
+    cv::Mat img_coarse;     ///< downscaled copy used by the coarse pass
+    cv::Mat img_gray;       ///< gray and pre-filtered road region
+    cv::Mat edge_coarse;
+    cv::Mat edge_img;       ///< full resolution edges of the frame. written out as the debug image
+    cv::Mat band_mask;      ///< full resolution pixels near coarse lines
+    cv::Mat refine_gray;
+    cv::Mat refine_edges;
+    std::vector<cv::Point> track_points; ///< edge pixels near a tracked line
+    std::vector<struct DebugLine> debug_lines; ///< Hough engine overlays, drawn only if the frame is sampled
+    struct LaneFit fit;     ///< bird's eye engine fit, drawn only if the frame is sampled
+    bool debug_sampled;     ///< the debug images of the frame are written out
+    struct LanePose pose;   ///< detection result
+    StageClock clock;       ///< per stage timing of the frame
+    struct LaneFilters* filters; ///< filters the frame is detected with
+    const struct LaneParams* params; ///< tuning the frame is detected with. set by LaneCore::prepare()
+    bool done;              ///< frame-parallel mode: detected and waiting in the reorder buffer
+};
+
+double detection_confidence(const std::vector<cv::Vec2d>& lane_lines_left,
+                            const std::vector<cv::Vec2d>& lane_lines_right);
+
+/// Lane finding on single frames with no ROS dependency. The node feeds it
+/// camera frames; lane_bench feeds it recorded ones. Per frame buffers live
+/// in a LaneWorkspace and per thread filters in LaneFilters, so one core can
+/// serve any number of workspaces. Only the tracker is shared between
+/// frames, which is why tracking needs frames detected one at a time, in
+/// order.
+class LaneCore
+{
+private:
+    WorkerPool* pool;     ///< helper threads for Hough voting. NULL votes on the calling thread
+    LaneTracker tracker;  ///< lane lines followed across frames
+    bool tracking;        ///< track_lanes as last seen by detect_hough(). starts false, so frames never tracked never write it
+
+    void trace(const char* format, ...) const;
+    void find_lines(struct LaneWorkspace& work, const cv::Mat& img, std::vector<cv::Vec2d>& lines,
+                    cv::Mat& edges, double scale);
+    void refine_lines(struct LaneWorkspace& work, const std::vector<cv::Vec2d>& coarse_lines, double scale,
+                      std::vector<cv::Vec2d>& lines, cv::Mat& edges);
+    void track_lines(struct LaneWorkspace& work, const cv::Vec2d predicted[NUM_LANE_SIDES],
+                     std::vector<cv::Vec2d>& lines);
+    void search_lines(struct LaneWorkspace& work, std::vector<cv::Vec2d>& lines);
+    void classify_lines(struct LaneWorkspace& work, const std::vector<cv::Vec2d>& lines,
+                        std::vector<cv::Vec2d>& raw_lines_left, std::vector<cv::Vec2d>& raw_lines_right);
+    void detect_hough(struct LaneWorkspace& work);
+    void detect_birds_eye(struct LaneWorkspace& work);
+
+public:
+    struct LaneParams params; ///< tuning of frames prepared without a snapshot of their own
+    bool verbose;          ///< print the lines and pose of every frame
+    struct PrefilterCache* prefilter_cache; ///< pre-filtered frames shared between lane_bench runs. NULL filters every frame
+
+    explicit LaneCore(WorkerPool* pool = NULL);
+
+    void reset();
+
+    void prepare(const cv::Mat& image, struct LaneWorkspace& work, const struct LaneParams* snapshot = NULL);
+    void detect(struct LaneWorkspace& work);
+    void draw_debug(struct LaneWorkspace& work);
+};
+
+#endif
@@ -7,50 +7,182 @@
 #include <cmath>
 #include <vector>
 #include <string>
+#include <atomic>
+#include <deque>
+#include <functional>
 #include <sys/time.h>
 #include "opencv2/opencv.hpp"
 #include "opencv2/core.hpp"
 #include "opencv2/imgproc.hpp"
 //#include "opencv2/imgcodecs.hpp"
+#include "sensor_msgs/Image.h"
+#include "diagnostic_msgs/DiagnosticArray.h"
+#include "diagnostic_msgs/KeyValue.h"
+#include "FramePool.h"
+#include "WorkerPool.h"
+#include "LaneCore.h"
+#include "LaneStreams.h"
+#include "FrameRecording.h"
+#include "QosController.h"
+#include "SpscQueue.h"
+#include "DebugWriter.h"
+#include "LatencyHistogram.h"
 
-struct LanePose
+#define FRAME_WAIT_TIMEOUT_MS 100 ///< upper bound on how long the detection thread takes to notice shutdown
+#define PIPELINE_WORKSPACES 4     ///< frames in flight in pipelined mode: one per stage plus one queued
+#define PIPELINE_SPIN_TRIES 64    ///< times a pipeline stage yields waiting for work before it starts sleeping
+#define PIPELINE_POLL_US 100      ///< sleep between checks of an empty pipeline queue
+
+/// Stage groups of the pipelined mode, each with its own thread
+enum PipelineStage
+{
+    PIPELINE_PREPARE, ///< frame copy and resize
+    PIPELINE_DETECT,  ///< lane engine
+    PIPELINE_OUTPUT,  ///< debug images and publishing
+    NUM_PIPELINE_STAGES
+};
+
+extern const char* PIPELINE_STAGE_NAMES[NUM_PIPELINE_STAGES];
+
+/// Running totals of one pipeline stage. Only the stage's thread writes them
+struct PipelineCounters
+{
+    std::atomic<unsigned long> frames;
+    std::atomic<unsigned long> busy_us;
+    std::atomic<unsigned long> stall_us;
+    std::atomic<unsigned long> depth_sum;
+    std::atomic<unsigned long> max_depth;
+
+    PipelineCounters() : frames(0), busy_us(0), stall_us(0), depth_sum(0), max_depth(0) {}
+};
+
+/// Frame counters of the frame-parallel mode
+struct ReorderStats
 {
-    int center_offset; ///< car's offset from center in pixels
-    double heading;    ///< car's deviation from straight in radians
-    double confidence; ///< confidence that a lane has actually be detected
+    unsigned long started;    ///< frames handed to the worker pool
+    unsigned long published;  ///< frames published, always in frame order
+    unsigned long superseded; ///< frames dropped because a later frame was ready to publish with them
 };
 
+/// Snapshot of the counters of one pipeline stage
+struct PipelineStageStats
+{
+    unsigned long frames;    ///< frames the stage finished
+    double busy_ms;          ///< time spent working on frames
+    double stall_ms;         ///< time spent waiting for a frame or workspace to work on
+    double mean_depth;       ///< workspaces waiting for the stage when it took one, on average
+    unsigned long max_depth;
+};
+
+/// ROS node side of the lane detector: takes camera frames, runs LaneCore
+/// on them in one of the threading modes and publishes the results
 class LaneDetector
 {
     friend void* lane_detection_loop(void* detector_ptr);
+    friend void* lane_prepare_loop(void* detector_ptr);
+    friend void* lane_detect_loop(void* detector_ptr);
+    friend void* lane_output_loop(void* detector_ptr);
+    friend void* lane_parallel_loop(void* detector_ptr);
 
 private:
     bool running;
-    int median_blur_radius; ///< radius used for median filtering. must be odd so it is kept private
     struct LanePose current_pose;
+    FramePool frame_pool;   ///< camera frames shared between the listener and the detection thread
+    WorkerPool worker_pool; ///< helper threads for parallel stages. one less than the number of cores
+    std::vector<struct LaneFilters> filter_sets;  ///< one, or one per frame in flight in frame-parallel mode
+    std::vector<struct LaneWorkspace> workspaces; ///< one, PIPELINE_WORKSPACES in pipelined mode or parallel_frames
+
+    bool pipelined;          ///< prepare, detect and output run on separate threads. set from ~pipeline
+    bool pipeline_pin_cores; ///< pin each pipeline stage thread to its own core
+    SpscQueue<struct LaneWorkspace*> free_queue;   ///< output stage to prepare stage
+    SpscQueue<struct LaneWorkspace*> detect_queue; ///< prepare stage to detect stage
+    SpscQueue<struct LaneWorkspace*> output_queue; ///< detect stage to output stage
+    struct PipelineCounters pipeline_counters[NUM_PIPELINE_STAGES];
+
+    int parallel_frames;    ///< frames detected at once in frame-parallel mode. set from ~frame_parallel, 1 disables it
+    std::vector<struct LaneWorkspace*> free_workspaces; ///< frame-parallel workspaces not in use. guarded by reorder_lock
+    std::deque<struct LaneWorkspace*> reorder_buffer;   ///< frame-parallel frames in flight, oldest first. guarded by reorder_lock
+    struct ReorderStats reorder_stats;                  ///< guarded by reorder_lock
+    pthread_mutex_t reorder_lock;
+    pthread_cond_t workspace_free; ///< signalled when a workspace is returned. waits use CLOCK_MONOTONIC
+    pthread_mutex_t publish_lock;  ///< held while publishing a frame-parallel or multi-camera result
+
+    FrameRecorder* recorder;       ///< records every frame handed to the detector. NULL unless ~record_path is set
+    LaneStreams* camera_streams;   ///< one stream per camera on the worker pool. NULL with one camera. set from ~cameras
+
+    DebugWriter* debug_writer; ///< writes debug images of sampled frames. NULL when sampling is off
+    LatencyHistogram stage_latency[NUM_LANE_STAGES]; ///< per stage times of every published frame
+    LatencyHistogram frame_latency; ///< sum of the stage times of every published frame
+    double latency_publish_period;  ///< seconds between latency diagnostics. 0 disables them. set from ~latency_publish_period
+    bool luma_only;                 ///< frames are kept as single channel luma instead of BGR. set from ~luma_only
+
+    struct LaneParams base_params;  ///< tuning from the ~ parameters and set_param() before QoS degradation. guarded by params_lock
+    QosController* qos;             ///< steps the tuning down when frames miss ~qos_deadline_ms. NULL when that is 0
+    int qos_level;                  ///< level the controller last asked base_params to be published at. guarded by params_lock
+    std::vector<QosController*> camera_qos;         ///< multi-camera mode with a deadline, by stream index
+    std::vector<struct LaneParams> camera_params;   ///< multi-camera mode: tuning of each camera before QoS degradation
+    std::atomic<const struct LaneParams*> live_params; ///< tuning new frames start with. replaced on change, never written to
+    std::vector<std::atomic<const struct LaneParams*> > params_in_use; ///< snapshot each workspace was prepared with, by workspace index
+    std::vector<const struct LaneParams*> retired_params; ///< replaced snapshots a workspace may still use. guarded by params_lock
+    pthread_mutex_t params_lock;    ///< serializes parameter updates. detection threads never take it
 
     ros::NodeHandle rosnode;
     ros::Subscriber laneimg_listener;
+    std::vector<ros::Subscriber> camera_listeners; ///< multi-camera mode, by stream index
+    std::vector<ros::Publisher> camera_publishers; ///< multi-camera mode, by stream index
+    ros::Subscriber params_listener;
     ros::Publisher pose_publisher;
+    ros::Publisher diagnostics_publisher;
 
-    pthread_t lane_detection_thread;
+    pthread_t lane_detection_thread; ///< runs every stage, or the prepare stage in pipelined mode
+    pthread_t detect_thread;
+    pthread_t output_thread;
     pthread_rwlock_t exit_semaphore;
 
-    void detect_lane();
+    void img_listener(const sensor_msgs::ImageConstPtr& img);
+    void camera_listener(const sensor_msgs::ImageConstPtr& img, int camera);
+    void start_cameras(const std::vector<std::string>& cameras, const struct RoadRegionConfig& roi,
+                       const struct BirdsEyeConfig& view);
+    void output_stream(struct LaneStream& stream);
+    void param_listener(const diagnostic_msgs::KeyValueConstPtr& setting);
+    const struct LaneParams* acquire_params(struct LaneWorkspace& work);
+    bool update_params(const std::function<bool(struct LaneParams&)>& change);
+    void publish_params();
+    void stop_pipeline(bool detect_started);
+    bool record_qos(QosController& controller, const struct LaneWorkspace& work, const std::string& camera);
+    void reclaim_params();
+    bool is_running();
+    void publish_latency();
+    void prepare_frame(FrameHandle& frame, struct LaneWorkspace& work);
+    void detect_frame(struct LaneWorkspace& work);
+    void output_frame(struct LaneWorkspace& work);
+    void detect_lane(FrameHandle& frame);
+    struct LaneWorkspace* take_free_workspace();
+    void recycle_workspace(struct LaneWorkspace* work);
+    void start_parallel_frame(struct LaneWorkspace* work);
+    void finish_parallel_frame(struct LaneWorkspace* work);
+    void wait_parallel_idle();
+    struct LaneWorkspace* pipeline_take(SpscQueue<struct LaneWorkspace*>& queue, struct PipelineCounters& counters);
 
 public:
-    int canny_grad_thresh; ///< gradient threshold needed to start a canny edge
-    int canny_cont_thresh; ///< gredient threshold needed to continue a canny edge
-    int hough_radius_inc;  ///< radius step size for Hough transform
-    double hough_theta_inc; ///< theta step size for Hough transform
-    int hough_min_votes;   ///< minimum number of votes needed to detect a Hough line
+    LaneCore core;         ///< lane finding on single frames. tuned from ~ parameters, then through set_param()
+    int strip_threads;     ///< OpenCV threads strips are spread over. 0 keeps OpenCV's default
+    int max_frame_age_ms;  ///< frames older than this when dequeued are skipped. 0 processes every frame
 
     LaneDetector();
     ~LaneDetector();
 
-    bool set_median_blur_radius(int radius);
-    void set_hough_theta_inc(double inc);
+    bool set_prefilter(enum PreFilterKind kind, int size);
+    bool set_param(const std::string& name, const std::string& value);
     struct LanePose get_vehicle_pose();
+    struct FramePoolStats get_frame_stats();
+    bool get_pipeline_stats(struct PipelineStageStats stats[NUM_PIPELINE_STAGES]);
+    bool get_reorder_stats(struct ReorderStats& stats);
+    bool get_debug_stats(struct DebugWriterStats& stats);
+    bool get_camera_stats(std::vector<struct LaneStreamStats>& stats);
+    bool get_recording_stats(struct RecordingStats& stats);
+    bool get_qos_stats(struct QosStats& stats);
+    void get_latency(struct LatencySummary stages[NUM_LANE_STAGES], struct LatencySummary& frame);
     void lane_guidance();
 };
 
@@ -0,0 +1,55 @@
+#ifndef __LANE_EVALUATION__
+#define __LANE_EVALUATION__
+
+#include <string>
+#include <vector>
+#include "opencv2/core.hpp"
+#include "LaneCore.h"
+#include "LatencyHistogram.h"
+
+#define EVAL_MIN_CONFIDENCE 0.5 ///< detections below this confidence count as no lane found
+
+/// Ground truth of one recorded frame
+struct LaneLabel
+{
+    bool labeled;          ///< the frame has ground truth. unlabeled frames are timed but not scored
+    bool lane;             ///< a lane is visible in the frame
+    double center_offset;  ///< true offset of the car from the lane center in reference width pixels
+};
+
+/// Accuracy and latency of the lane core over a set of labeled frames
+struct LaneEvaluation
+{
+    unsigned long frames;           ///< frames run
+    unsigned long lane_frames;      ///< labeled frames with a lane
+    unsigned long detected;         ///< lane frames where a lane was found
+    unsigned long empty_frames;     ///< labeled frames without a lane
+    unsigned long false_detections; ///< empty frames where a lane was found anyway
+    double detection_rate;          ///< detected / lane_frames
+    double false_rate;              ///< false_detections / empty_frames
+    double mean_offset_error;       ///< mean absolute offset error of detected lane frames in reference width pixels
+    double p95_offset_error;
+    struct LatencySummary latency;  ///< whole frame latency, resize included
+};
+
+/// Pass and fail limits of a regression run, relative to a known good run
+struct LaneBaseline
+{
+    double detection_rate;
+    double false_rate;
+    double mean_offset_error;
+    double p95_latency_ms;
+    double detection_tolerance; ///< detection and false rates may be this much worse than the baseline
+    double offset_tolerance;    ///< pixels the mean offset error may grow by
+    double latency_budget;      ///< factor the p95 latency may grow by
+};
+
+bool load_lane_labels(const std::string& path, size_t num_frames, std::vector<struct LaneLabel>& labels);
+struct LaneEvaluation evaluate_lanes(LaneCore& core, struct LaneFilters& filters, const std::vector<cv::Mat>& frames,
+                                     const std::vector<struct LaneLabel>& labels);
+
+bool load_lane_baseline(const std::string& path, struct LaneBaseline& baseline);
+bool save_lane_baseline(const std::string& path, const struct LaneEvaluation& evaluation);
+bool check_lane_baseline(const struct LaneEvaluation& evaluation, const struct LaneBaseline& baseline);
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef __LANE_STREAMS__
+#define __LANE_STREAMS__
+
+#include <pthread.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <functional>
+#include "FramePool.h"
+#include "WorkerPool.h"
+#include "LaneCore.h"
+#include "LatencyHistogram.h"
+
+/// One camera served by LaneStreams with its own frame slots, tuning, tracker
+/// and filters. At most one detection job of a stream is queued or running at
+/// a time, so its frames are detected in order and can be tracked.
+struct LaneStream
+{
+    std::string name;
+    int index;                   ///< position in LaneStreams
+    FramePool frames;            ///< newest frames of the camera
+    LaneCore core;               ///< tuning and tracker of the camera. set up before frames arrive
+    struct LaneFilters filters;
+    struct LaneWorkspace work;   ///< the frame being detected. the output callback reads the result here
+    unsigned long last_sequence; ///< newest frame taken. only touched by the stream's job
+    std::atomic<bool> scheduled; ///< a job of the stream is queued or running
+    std::atomic<unsigned long> detected;
+    LatencyHistogram stage_latency[NUM_LANE_STAGES];
+    LatencyHistogram frame_latency;
+
+    LaneStream(const std::string& name, int index, WorkerPool* pool);
+};
+
+/// Frame and latency counters of one stream
+struct LaneStreamStats
+{
+    std::string name;
+    struct FramePoolStats frames;
+    unsigned long detected;
+    struct LatencySummary latency; ///< whole frames, including the output callback
+};
+
+/// Called on a worker thread once a frame of a stream is detected
+typedef std::function<void(struct LaneStream&)> LaneStreamOutput;
+
+/// Lane detection for several cameras on one shared WorkerPool. Committing
+/// a frame schedules a job for its stream unless one is already pending;
+/// each job detects the newest frame of its stream and queues the next job
+/// behind the other streams' if another frame arrived meanwhile, so a busy
+/// camera cannot starve the rest and no thread sits idle per camera.
+class LaneStreams
+{
+private:
+    WorkerPool& pool;
+    LaneStreamOutput output;
+    std::vector<struct LaneStream*> streams;
+    bool running;                ///< guarded by jobs_lock
+    int jobs;                    ///< jobs queued or running. guarded by jobs_lock
+    pthread_mutex_t jobs_lock;
+    pthread_cond_t jobs_done;    ///< signalled when jobs drops to 0
+
+    void schedule(struct LaneStream& stream);
+    void run(struct LaneStream& stream);
+
+public:
+    int max_frame_age_ms; ///< frames older than this when taken are skipped. 0 detects every frame taken
+
+    LaneStreams(WorkerPool& pool, const LaneStreamOutput& output);
+    ~LaneStreams();
+
+    struct LaneStream& add_stream(const std::string& name);
+    size_t size() const;
+    struct LaneStream& operator[](size_t index);
+
+    void commit_frame(struct LaneStream& stream, FrameSlot* slot);
+    void stop();
+    void get_stats(std::vector<struct LaneStreamStats>& stats);
+};
+
+#endif
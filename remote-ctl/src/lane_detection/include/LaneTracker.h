@@ -0,0 +1,37 @@
+#ifndef __LANE_TRACKER__
+#define __LANE_TRACKER__
+
+#include "opencv2/core.hpp"
+#include "opencv2/video/tracking.hpp"
+
+#define TRACK_LOCK_FRAMES 3 ///< consecutive confident detections before only searching around predictions
+
+enum LaneSide
+{
+    LANE_LEFT,
+    LANE_RIGHT,
+    NUM_LANE_SIDES
+};
+
+/// Follows the left and right lane lines from frame to frame. Each line's
+/// (radius, theta) and their change per frame are estimated by a constant
+/// velocity Kalman filter, in the coordinates of the image they were
+/// measured on.
+class LaneTracker
+{
+private:
+    cv::KalmanFilter filters[NUM_LANE_SIDES];
+    cv::Size size; ///< image size the tracked lines belong to
+    int hits;      ///< consecutive corrected frames. 0 when nothing is tracked
+
+public:
+    LaneTracker();
+
+    void reset();
+    bool predict(const cv::Size& size, cv::Vec2d predicted[NUM_LANE_SIDES]);
+    void correct(const cv::Size& size, const cv::Vec2d measured[NUM_LANE_SIDES]);
+    bool locked() const;
+    cv::Vec2d get_line(enum LaneSide side) const;
+};
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef __LANE_TUNER__
+#define __LANE_TUNER__
+
+#include <string>
+#include <vector>
+#include <utility>
+#include "opencv2/core.hpp"
+#include "WorkerPool.h"
+#include "LaneEvaluation.h"
+
+/// One setting swept by the tuner and the values it tries
+struct SweepParameter
+{
+    std::string name;                ///< LaneParams::set_option() name
+    std::vector<std::string> values;
+};
+
+/// Settings and score of one combination of swept values
+struct TuneResult
+{
+    std::vector<std::pair<std::string, std::string> > settings;
+    struct LaneEvaluation evaluation;
+    double accuracy; ///< labeled frames where lane found or not matched the label
+    bool pareto;     ///< no other combination is at least as accurate and fast and better at one of them
+};
+
+bool load_lane_sweep(const std::string& path, std::vector<struct SweepParameter>& sweep);
+void tune_lanes(const std::vector<struct SweepParameter>& sweep, const std::vector<cv::Mat>& frames,
+                const std::vector<struct LaneLabel>& labels, WorkerPool& pool, int threads,
+                std::vector<struct TuneResult>& results);
+void pareto_front(std::vector<struct TuneResult>& results, std::vector<const struct TuneResult*>& front);
+bool save_lane_config(const std::string& path, const std::vector<const struct TuneResult*>& front);
+
+#endif
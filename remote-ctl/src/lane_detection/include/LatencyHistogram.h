@@ -0,0 +1,46 @@
+#ifndef __LATENCY_HISTOGRAM__
+#define __LATENCY_HISTOGRAM__
+
+#include <atomic>
+
+#define LATENCY_SUB_BITS 4      ///< each power of two is split into 2^LATENCY_SUB_BITS buckets, about 6% resolution
+#define LATENCY_MAX_EXPONENT 26 ///< highest power of two kept apart, so up to about 134 s in microseconds
+#define LATENCY_BUCKETS ((LATENCY_MAX_EXPONENT - LATENCY_SUB_BITS + 2) << LATENCY_SUB_BITS)
+
+/// Percentiles of a LatencyHistogram in milliseconds
+struct LatencySummary
+{
+    unsigned long count;
+    double mean_ms;
+    double p50_ms;
+    double p95_ms;
+    double p99_ms;
+    double max_ms;
+};
+
+/// Log-linear histogram of durations in the style of HdrHistogram. Values
+/// below 2^LATENCY_SUB_BITS microseconds get a bucket each, above that every
+/// power of two is split into the same number of equal buckets, so the
+/// relative error stays constant from microseconds to seconds. Recording is
+/// a few relaxed atomic adds, safe from any number of threads without locks.
+class LatencyHistogram
+{
+private:
+    std::atomic<unsigned long> buckets[LATENCY_BUCKETS];
+    std::atomic<unsigned long> count;
+    std::atomic<unsigned long> sum_us;
+    std::atomic<unsigned long> max_us;
+
+    static int bucket_index(unsigned long value_us);
+    static unsigned long bucket_lower(int index);
+    static unsigned long bucket_upper(int index);
+
+public:
+    LatencyHistogram();
+
+    void record(double ms);
+    void reset();
+    struct LatencySummary summarize() const;
+};
+
+#endif
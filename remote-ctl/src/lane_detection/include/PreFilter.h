@@ -0,0 +1,59 @@
+#ifndef __PRE_FILTER__
+#define __PRE_FILTER__
+
+#include "opencv2/core.hpp"
+#include "StageClock.h"
+
+#define LANE_REFERENCE_WIDTH 1280 ///< image width the pixel based parameters are tuned for
+#define BILATERAL_LEVELS 8 ///< intensity levels the bilateral approximation interpolates between
+
+/// Noise filter applied before edge detection
+enum PreFilterKind
+{
+    PREFILTER_COLOR_MEDIAN, ///< median on all three color channels, then gray conversion (original path)
+    PREFILTER_MEDIAN,       ///< gray conversion, then median. large kernels use OpenCV's O(1) histogram median
+    PREFILTER_BOX,          ///< gray conversion, then a separable running sum box filter
+    PREFILTER_GAUSSIAN,     ///< gray conversion, then a separable Gaussian with sigma derived from the size
+    PREFILTER_BILATERAL,    ///< gray conversion, then a piecewise linear bilateral approximation
+    NUM_PREFILTER_KINDS
+};
+
+#define PREFILTER_DEFAULT_KIND PREFILTER_MEDIAN ///< pre-filter of a newly made PreFilter or LaneParams
+#define PREFILTER_DEFAULT_SIZE 25              ///< pre-filter kernel size at LANE_REFERENCE_WIDTH by default
+
+extern const char* PREFILTER_NAMES[NUM_PREFILTER_KINDS];
+
+/// Converts frames to gray and removes localized noise and detail ahead of
+/// Canny. Every kind except PREFILTER_COLOR_MEDIAN filters a single channel.
+class PreFilter
+{
+private:
+    enum PreFilterKind kind;
+    int size; ///< kernel size in pixels at LANE_REFERENCE_WIDTH
+
+    cv::Mat color_work;
+    cv::Mat gray_f;
+    cv::Mat sum_f;
+    cv::Mat weight;
+    cv::Mat weighted;
+    cv::Mat level_num;
+    cv::Mat level_den;
+    cv::Mat level_interp;
+    cv::Mat range_luts[BILATERAL_LEVELS];  ///< gaussian range weight of every gray value for each level
+    cv::Mat interp_luts[BILATERAL_LEVELS]; ///< linear interpolation weight of every gray value for each level
+
+    void bilateral(const cv::Mat& gray, cv::Mat& dst, int kernel);
+
+public:
+    PreFilter();
+
+    static bool valid(enum PreFilterKind kind, int size);
+    bool configure(enum PreFilterKind kind, int size);
+    enum PreFilterKind get_kind() const;
+    int get_size() const;
+    int scaled_size(double scale) const;
+
+    void apply(const cv::Mat& src, cv::Mat& dst, int kernel, StageClock* clock = NULL);
+};
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef __QOS_CONTROLLER__
+#define __QOS_CONTROLLER__
+
+#include "LaneCore.h"
+
+#define QOS_LEVELS 5       ///< level 0 runs the configured tuning, every level above it degrades one more step
+#define QOS_DOWN_AFTER 2   ///< consecutive missed deadlines before stepping down a level
+#define QOS_UP_AFTER 30    ///< consecutive frames with headroom before stepping back up a level
+#define QOS_HEADROOM 0.6   ///< frames faster than this share of the deadline have headroom
+
+extern const char* QOS_LEVEL_NAMES[QOS_LEVELS];
+
+/// Counters of a QosController
+struct QosStats
+{
+    unsigned long frames;
+    unsigned long missed;  ///< frames over the deadline
+    unsigned long changes; ///< level steps taken in either direction
+    unsigned long level_frames[QOS_LEVELS]; ///< frames detected at each level
+};
+
+/// Trades detection quality for time when frames miss their deadline. Each
+/// detected frame is reported with the level it was detected at; a couple
+/// of misses in a row step the level down, a long run of frames well under
+/// the deadline steps it back up. Frames detected at another level than the
+/// current one, because they were prepared before the last step, are
+/// counted but do not move the level.
+class QosController
+{
+private:
+    double deadline_ms;
+    int level;
+    int misses; ///< consecutive frames at the current level over the deadline
+    int calm;   ///< consecutive frames at the current level with headroom
+    struct QosStats stats;
+
+public:
+    explicit QosController(double deadline_ms);
+
+    bool record(double frame_ms, int frame_level);
+    int get_level() const;
+    double get_deadline() const;
+    struct QosStats get_stats() const;
+};
+
+bool qos_supported(const struct LaneParams& params);
+void qos_params(const struct LaneParams& base, int level, struct LaneParams& params);
+
+#endif
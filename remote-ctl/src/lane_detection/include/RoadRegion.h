@@ -0,0 +1,43 @@
+#ifndef __ROAD_REGION__
+#define __ROAD_REGION__
+
+#include <vector>
+#include "opencv2/core.hpp"
+
+/// Trapezoidal region of the image the road can appear in. Corners are given
+/// as fractions of the image size so one configuration serves every
+/// resolution; it only depends on how the camera is mounted.
+struct RoadRegionConfig
+{
+    double top;          ///< row of the top (far) edge as a fraction of image height
+    double top_left;     ///< column of the top left corner as a fraction of image width
+    double top_right;    ///< column of the top right corner as a fraction of image width
+    double bottom_left;  ///< column of the bottom left corner as a fraction of image width
+    double bottom_right; ///< column of the bottom right corner as a fraction of image width
+};
+
+/// Road region rasterized for one image size
+struct RoadMask
+{
+    cv::Size size; ///< image size the mask was built for
+    cv::Rect crop; ///< bounding rectangle of the trapezoid. all filtering is done inside it
+    cv::Mat mask;  ///< crop sized 8 bit mask, nonzero inside the trapezoid
+};
+
+class RoadRegion
+{
+private:
+    struct RoadRegionConfig config;
+    std::vector<struct RoadMask> masks; ///< one entry per resolution seen so far
+
+public:
+    RoadRegion();
+
+    void configure(const struct RoadRegionConfig& config);
+    const struct RoadRegionConfig& get_config() const;
+    const struct RoadMask& get_mask(const cv::Size& size);
+};
+
+void clear_outside(cv::Mat& img, const cv::Rect& rect);
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef __SPSC_QUEUE__
+#define __SPSC_QUEUE__
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+
+#define CACHE_LINE_SIZE 64 ///< padding that keeps the producer and consumer indices on separate cache lines
+
+/// Bounded lock-free queue for exactly one producer thread and one consumer
+/// thread. Both sides only ever write their own index, so pushing and popping
+/// are a few loads and stores with no locks or read-modify-write operations.
+/// The indices count up forever and are reduced modulo the capacity, which
+/// tells a full queue apart from an empty one without a spare slot.
+template <class T>
+class SpscQueue
+{
+private:
+    std::vector<T> slots;
+    std::atomic<size_t> head; ///< next slot to pop. written by the consumer only
+    char head_padding[CACHE_LINE_SIZE];
+    std::atomic<size_t> tail; ///< next slot to push. written by the producer only
+    char tail_padding[CACHE_LINE_SIZE];
+
+public:
+    explicit SpscQueue(size_t capacity) : slots(capacity), head(0), tail(0)
+    {
+    }
+
+    /**
+     * Appends a value. Returns false without blocking if the queue is full.
+     * Producer thread only.
+     */
+    bool try_push(const T& value)
+    {
+        size_t position = tail.load(std::memory_order_relaxed);
+        if (position - head.load(std::memory_order_acquire) >= slots.size())
+        {
+            return false;
+        }
+
+        slots[position % slots.size()] = value;
+        tail.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Removes the oldest value. Returns false without blocking if the queue
+     * is empty. Consumer thread only.
+     */
+    bool try_pop(T& value)
+    {
+        size_t position = head.load(std::memory_order_relaxed);
+        if (position == tail.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+
+        value = slots[position % slots.size()];
+        head.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Number of queued values. Exact from either end's own thread, a snapshot
+     * anywhere else.
+     */
+    size_t size() const
+    {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+    }
+
+    size_t capacity() const
+    {
+        return slots.size();
+    }
+};
+
+#endif
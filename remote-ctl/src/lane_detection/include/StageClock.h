@@ -0,0 +1,48 @@
+#ifndef __STAGE_CLOCK__
+#define __STAGE_CLOCK__
+
+#include <chrono>
+
+/// Processing stages of the lane pipeline that are timed separately
+enum LaneStage
+{
+    STAGE_WAIT, ///< frame waiting in the frame pool before processing started
+    STAGE_RESIZE,
+    STAGE_GRAY,
+    STAGE_BLUR,
+    STAGE_CANNY,
+    STAGE_HOUGH,
+    STAGE_REFINE,
+    STAGE_TRACK,
+    STAGE_WARP,
+    STAGE_FIT,
+    STAGE_CLASSIFY,
+    STAGE_CONFIDENCE,
+    STAGE_DEBUG,
+    STAGE_PUBLISH,
+    NUM_LANE_STAGES
+};
+
+extern const char* LANE_STAGE_NAMES[NUM_LANE_STAGES];
+
+/// Splits the processing time of one frame into stages. Each call to
+/// end_stage() charges the time since the previous call to a stage.
+class StageClock
+{
+private:
+    std::chrono::steady_clock::time_point stage_start;
+
+public:
+    double stage_ms[NUM_LANE_STAGES]; ///< time spent in each stage since start()
+
+    StageClock();
+
+    void start();
+    void resume();
+    void end_stage(enum LaneStage stage);
+    void add(enum LaneStage stage, double ms);
+    double total_ms() const;
+    void print() const;
+};
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef __STRIP_EDGES__
+#define __STRIP_EDGES__
+
+#include <vector>
+#include "opencv2/core.hpp"
+#include "PreFilter.h"
+
+#define STRIP_CANNY_HALO 4 ///< rows either side of a strip for the Sobel, non-maximum suppression and nearby hysteresis
+
+/// Buffers of one strip. Each strip has its own pre-filter because the
+/// pre-filter keeps scratch buffers
+struct StripBuffers
+{
+    PreFilter prefilter;
+    cv::Mat gray;
+    cv::Mat edges;
+};
+
+/// Gray conversion, pre-filter and Canny run strip by strip. The image is
+/// cut into horizontal strips and every strip, widened by halo rows, goes
+/// through all three stages on one thread while it is still in cache,
+/// instead of each stage making its own pass over the whole image. Strips
+/// are spread over OpenCV's threads with cv::parallel_for_.
+///
+/// Edges match a full image pass except where Canny hysteresis would follow
+/// a weak edge further than the halo across a strip boundary.
+class StripEdges
+{
+private:
+    int strip_rows; ///< rows per strip. 0 filters the whole image in one pass
+    std::vector<struct StripBuffers> strips;
+
+public:
+    StripEdges();
+
+    void configure(int strip_rows);
+    int get_strip_rows() const;
+
+    void detect(const PreFilter& prefilter, const cv::Mat& src, cv::Mat& edges, int kernel,
+                double canny_low, double canny_high);
+};
+
+#endif
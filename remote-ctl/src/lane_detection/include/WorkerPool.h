@@ -0,0 +1,49 @@
+#ifndef __WORKER_POOL__
+#define __WORKER_POOL__
+
+#include <pthread.h>
+#include <deque>
+#include <vector>
+#include <functional>
+
+struct ParallelBatch;
+
+/// Unit of work queued on a WorkerPool. Either a standalone job or one
+/// index of a parallel_for() batch, which avoids a std::function per index.
+struct WorkerTask
+{
+    std::function<void()> job;
+    const std::function<void(int)>* body;
+    int index;
+    struct ParallelBatch* batch;
+};
+
+/// Fixed set of persistent worker threads. Threads are created once so
+/// handing work to them per frame costs a queue push, not a pthread_create.
+class WorkerPool
+{
+    friend void* worker_loop(void* pool_ptr);
+
+private:
+    bool running;
+    std::vector<pthread_t> threads;
+    std::deque<struct WorkerTask> tasks;
+
+    pthread_mutex_t queue_lock;
+    pthread_cond_t task_ready;
+
+    void stop();
+    bool next_task(struct WorkerTask& task);
+    bool steal_task(struct ParallelBatch* batch, struct WorkerTask& task);
+    static void run_task(struct WorkerTask& task);
+
+public:
+    explicit WorkerPool(int num_threads);
+    ~WorkerPool();
+
+    int size() const;
+    void submit(const std::function<void()>& job);
+    void parallel_for(int count, const std::function<void(int)>& body);
+};
+
+#endif
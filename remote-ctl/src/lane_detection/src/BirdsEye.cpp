@@ -0,0 +1,344 @@
+#include "BirdsEye.h"
+#include <cmath>
+#include <algorithm>
+#include "opencv2/imgproc.hpp"
+
+using namespace std;
+
+/**
+ * The default view assumes a camera centered on the car looking down the
+ * road, with the road narrowing to a third of the image width just below
+ * the middle of the image
+ */
+BirdsEye::BirdsEye() : car_x(0.0)
+{
+    config.ground.top = 0.55;
+    config.ground.top_left = 0.35;
+    config.ground.top_right = 0.65;
+    config.ground.bottom_left = 0.0;
+    config.ground.bottom_right = 1.0;
+    config.view_width = 1.5;
+    config.view_length = 3.0;
+    config.warp_width = 200;
+    config.warp_height = 400;
+    config.window_margin = 20;
+}
+
+/**
+ * Replaces the calibration. The remap table is rebuilt with the next frame.
+ */
+void BirdsEye::configure(const struct BirdsEyeConfig& new_config)
+{
+    config = new_config;
+    image_size = cv::Size();
+}
+
+const struct BirdsEyeConfig& BirdsEye::get_config() const
+{
+    return config;
+}
+
+/**
+ * Builds the table mapping every top down pixel back to the image position
+ * it shows. The table is stored in OpenCV's fixed point format, which
+ * remap() handles fastest.
+ */
+void BirdsEye::build_maps(const cv::Size& size)
+{
+    const struct RoadRegionConfig& ground = config.ground;
+    cv::Point2f view_corners[4] = {
+        cv::Point2f(0.0f, 0.0f),
+        cv::Point2f((float)config.warp_width, 0.0f),
+        cv::Point2f((float)config.warp_width, (float)config.warp_height),
+        cv::Point2f(0.0f, (float)config.warp_height)
+    };
+    cv::Point2f ground_corners[4] = {
+        cv::Point2f((float)(ground.top_left * size.width), (float)(ground.top * size.height)),
+        cv::Point2f((float)(ground.top_right * size.width), (float)(ground.top * size.height)),
+        cv::Point2f((float)(ground.bottom_right * size.width), (float)size.height),
+        cv::Point2f((float)(ground.bottom_left * size.width), (float)size.height)
+    };
+
+    cv::Mat transform = cv::getPerspectiveTransform(view_corners, ground_corners);
+    const double* m = transform.ptr<double>();
+    cv::Mat map(config.warp_height, config.warp_width, CV_32FC2);
+
+    for (int v = 0; v < config.warp_height; v++)
+    {
+        cv::Vec2f* row = map.ptr<cv::Vec2f>(v);
+
+        for (int u = 0; u < config.warp_width; u++)
+        {
+            double z = m[6] * u + m[7] * v + m[8];
+            row[u] = cv::Vec2f((float)((m[0] * u + m[1] * v + m[2]) / z),
+                               (float)((m[3] * u + m[4] * v + m[5]) / z));
+        }
+    }
+
+    cv::convertMaps(map, cv::Mat(), map_xy, map_frac, CV_16SC2);
+    image_size = size;
+
+    // the camera looks straight ahead from the middle of the image
+    car_x = (0.5 - ground.bottom_left) / (ground.bottom_right - ground.bottom_left) * config.view_width;
+}
+
+/**
+ * Column of the tallest histogram bin in [begin, end), or -1 if no column
+ * has enough edge pixels to start a line from
+ */
+int BirdsEye::find_base(int begin, int end) const
+{
+    const int* bins = histogram.ptr<int>();
+    int best = -1;
+    int best_count = BEV_MIN_WINDOW_PIXELS * 255 - 1;
+
+    for (int column = begin; column < end; column++)
+    {
+        if (bins[column] > best_count)
+        {
+            best = column;
+            best_count = bins[column];
+        }
+    }
+
+    return best;
+}
+
+/**
+ * Follows a line up the view from its base column with a stack of windows,
+ * each centered on the mean column of the pixels found in the one below.
+ * Pixels of windows with enough of them are collected in meters into ss and
+ * xs. Returns the number of such windows.
+ */
+int BirdsEye::slide_windows(int base)
+{
+    ss.clear();
+    xs.clear();
+
+    if (base < 0)
+    {
+        return 0;
+    }
+
+    int window_height = edges.rows / BEV_WINDOWS;
+    double meters_x = config.view_width / edges.cols;
+    double meters_y = config.view_length / edges.rows;
+    int center = base;
+    int hits = 0;
+
+    for (int window = 0; window < BEV_WINDOWS; window++)
+    {
+        int bottom = edges.rows - window * window_height;
+        cv::Rect rect = cv::Rect(center - config.window_margin, bottom - window_height,
+                                 2 * config.window_margin + 1, window_height) & cv::Rect(0, 0, edges.cols, edges.rows);
+        if (rect.empty())
+        {
+            break;
+        }
+
+        windows.push_back(rect);
+        size_t first = xs.size();
+        long column_sum = 0;
+
+        for (int row = rect.y; row < rect.y + rect.height; row++)
+        {
+            const uchar* pixels = edges.ptr<uchar>(row);
+
+            for (int column = rect.x; column < rect.x + rect.width; column++)
+            {
+                if (pixels[column])
+                {
+                    ss.push_back((edges.rows - row - 0.5) * meters_y);
+                    xs.push_back((column + 0.5) * meters_x);
+                    column_sum += column;
+                }
+            }
+        }
+
+        int count = (int)(xs.size() - first);
+        if (count < BEV_MIN_WINDOW_PIXELS)
+        {
+            ss.resize(first);
+            xs.resize(first);
+            continue;
+        }
+
+        center = (int)(column_sum / count);
+        hits++;
+    }
+
+    return hits;
+}
+
+/**
+ * Least squares fit of x = c[0] + c[1] * s + c[2] * s^2 to the collected
+ * pixels
+ */
+bool BirdsEye::fit_line(cv::Vec3d& coeffs) const
+{
+    cv::Matx33d normal;
+    cv::Vec3d rhs(0.0, 0.0, 0.0);
+
+    for (size_t index = 0; index < ss.size(); index++)
+    {
+        double powers[3] = { 1.0, ss[index], ss[index] * ss[index] };
+
+        for (int row = 0; row < 3; row++)
+        {
+            for (int column = 0; column < 3; column++)
+            {
+                normal(row, column) += powers[row] * powers[column];
+            }
+
+            rhs[row] += powers[row] * xs[index];
+        }
+    }
+
+    return ss.size() >= 3 && cv::solve(normal, rhs, coeffs, cv::DECOMP_CHOLESKY);
+}
+
+/**
+ * Warps a BGR or gray frame to the top down view, finds edges and fits both
+ * lane lines. The base of each line is the tallest column of a histogram of
+ * the lower half of the view, on the respective side of the car. fit always
+ * receives the per line results; the lane geometry is only filled in if
+ * both lines are found. Returns fit.found.
+ */
+bool BirdsEye::detect(const cv::Mat& img, double canny_low, double canny_high, struct LaneFit& fit,
+                      StageClock* clock)
+{
+    if (img.size() != image_size)
+    {
+        build_maps(img.size());
+    }
+
+    cv::remap(img, warped, map_xy, map_frac, cv::INTER_LINEAR);
+    if (clock)
+    {
+        clock->end_stage(STAGE_WARP);
+    }
+
+    if (warped.channels() == 1)
+    {
+        warped_gray = warped;
+    }
+    else
+    {
+        cv::cvtColor(warped, warped_gray, cv::COLOR_BGR2GRAY);
+    }
+    if (clock)
+    {
+        clock->end_stage(STAGE_GRAY);
+    }
+
+    cv::GaussianBlur(warped_gray, warped_gray, cv::Size(5, 5), 0.0);
+    if (clock)
+    {
+        clock->end_stage(STAGE_BLUR);
+    }
+
+    cv::Canny(warped_gray, edges, canny_low, canny_high);
+    if (clock)
+    {
+        clock->end_stage(STAGE_CANNY);
+    }
+
+    cv::reduce(edges.rowRange(edges.rows / 2, edges.rows), histogram, 0, cv::REDUCE_SUM, CV_32S);
+    int car_column = min(max((int)(car_x / config.view_width * edges.cols), 1), edges.cols - 1);
+    windows.clear();
+
+    fit.left_windows = slide_windows(find_base(0, car_column));
+    bool left_found = fit.left_windows >= BEV_MIN_LINE_WINDOWS && fit_line(fit.left);
+    fit.right_windows = slide_windows(find_base(car_column, edges.cols));
+    bool right_found = fit.right_windows >= BEV_MIN_LINE_WINDOWS && fit_line(fit.right);
+
+    fit.found = false;
+    fit.center_offset = 0.0;
+    fit.heading = 0.0;
+    fit.curvature = 0.0;
+    fit.confidence = 0.0;
+
+    if (left_found && right_found)
+    {
+        // lines on a flat road are parallel in the top down view, so the
+        // lane should be about as wide at the top as at the bottom
+        double near_width = fit.right[0] - fit.left[0];
+        double far_s = config.view_length;
+        double far_width = (fit.right[0] + fit.right[1] * far_s + fit.right[2] * far_s * far_s) -
+                           (fit.left[0] + fit.left[1] * far_s + fit.left[2] * far_s * far_s);
+
+        if (near_width > 0.0 && far_width > 0.0)
+        {
+            double center[3];
+            for (int index = 0; index < 3; index++)
+            {
+                center[index] = (fit.left[index] + fit.right[index]) / 2.0;
+            }
+
+            fit.found = true;
+            fit.center_offset = car_x - center[0];
+            fit.heading = atan(center[1]);
+            fit.curvature = 2.0 * center[2] / pow(1.0 + center[1] * center[1], 1.5);
+            fit.confidence = (double)min(fit.left_windows, fit.right_windows) / BEV_WINDOWS *
+                             min(near_width, far_width) / max(near_width, far_width);
+        }
+    }
+
+    if (clock)
+    {
+        clock->end_stage(STAGE_FIT);
+    }
+
+    return fit.found;
+}
+
+/**
+ * Edges of the latest top down view
+ */
+const cv::Mat& BirdsEye::get_edges() const
+{
+    return edges;
+}
+
+/**
+ * Draws the sliding windows and the fitted lines of the latest frame onto a
+ * top down sized 8 bit image
+ */
+void BirdsEye::draw(cv::Mat& img, const struct LaneFit& fit) const
+{
+    for (const cv::Rect& window : windows)
+    {
+        cv::rectangle(img, window, cv::Scalar(128.0), 1);
+    }
+
+    if (!fit.found)
+    {
+        return;
+    }
+
+    double pixels_x = img.cols / config.view_width;
+    double pixels_y = img.rows / config.view_length;
+
+    for (const cv::Vec3d& line : { fit.left, fit.right })
+    {
+        vector<cv::Point> curve;
+
+        for (int row = 0; row < img.rows; row += 10)
+        {
+            double s = (img.rows - row) / pixels_y;
+            double x = line[0] + line[1] * s + line[2] * s * s;
+            curve.push_back(cv::Point((int)(x * pixels_x), row));
+        }
+
+        cv::polylines(img, curve, false, cv::Scalar(255.0), 3);
+    }
+}
+
+/**
+ * Converts meters across the bottom edge of the view to pixels along the
+ * bottom row of an image of the given width
+ */
+int BirdsEye::offset_pixels(double meters, int image_width) const
+{
+    return (int)(meters / config.view_width * (config.ground.bottom_right - config.ground.bottom_left) * image_width);
+}
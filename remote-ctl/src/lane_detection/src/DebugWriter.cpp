@@ -0,0 +1,147 @@
+#include "DebugWriter.h"
+#include <stdexcept>
+#include <algorithm>
+#include <cstdio>
+#include <sys/time.h>
+#include "opencv2/imgcodecs.hpp"
+
+using namespace std;
+
+/**
+ * Writes queued frames until the writer is stopped and the queue is empty
+ */
+void* debug_writer_loop(void* writer_ptr)
+{
+    DebugWriter* writer = (DebugWriter*)writer_ptr;
+    char filename[256];
+
+    pthread_mutex_lock(&writer->queue_lock);
+    for (;;)
+    {
+        while (writer->count == 0 && writer->running)
+        {
+            pthread_cond_wait(&writer->frame_queued, &writer->queue_lock);
+        }
+
+        if (writer->count == 0)
+        {
+            break;
+        }
+
+        // the producer never touches queued slots, so the slot is written
+        // without holding the lock
+        struct DebugImages& images = writer->slots[writer->head];
+        pthread_mutex_unlock(&writer->queue_lock);
+
+        // <ms>_<sequence> or <ms>_<camera>_<sequence>, so frames queued in
+        // the same millisecond by different cameras do not overwrite each other
+        string prefix = writer->directory + "/" + to_string(images.stamp_ms) + "_" +
+                        (images.stream.empty() ? "" : images.stream + "_") + to_string(images.sequence);
+
+        snprintf(filename, sizeof(filename), "%s_img.jpg", prefix.c_str());
+        cv::imwrite(filename, images.img);
+
+        snprintf(filename, sizeof(filename), "%s_edges.jpg", prefix.c_str());
+        cv::imwrite(filename, images.edges);
+
+        pthread_mutex_lock(&writer->queue_lock);
+        writer->head = (writer->head + 1) % (int)writer->slots.size();
+        writer->count--;
+        writer->stats.written++;
+    }
+    pthread_mutex_unlock(&writer->queue_lock);
+
+    return NULL;
+}
+
+DebugWriter::DebugWriter(const string& directory, int every_n, double min_confidence, int queue_size) :
+    directory(directory), every_n(max(0, every_n)), min_confidence(min_confidence), slots(max(1, queue_size)),
+    head(0), count(0), running(true)
+{
+    stats.queued = 0;
+    stats.written = 0;
+    stats.dropped = 0;
+
+    if (pthread_mutex_init(&queue_lock, NULL) != 0 || pthread_cond_init(&frame_queued, NULL) != 0)
+    {
+        throw runtime_error("DebugWriter: failed to initialize the queue");
+    }
+
+    if (pthread_create(&writer_thread, NULL, &debug_writer_loop, (void*)this) != 0)
+    {
+        throw runtime_error("DebugWriter: failed to start the writer thread");
+    }
+}
+
+/**
+ * Writes out whatever is still queued, then stops the writer thread
+ */
+DebugWriter::~DebugWriter()
+{
+    pthread_mutex_lock(&queue_lock);
+    running = false;
+    pthread_cond_signal(&frame_queued);
+    pthread_mutex_unlock(&queue_lock);
+
+    pthread_join(writer_thread, NULL);
+    pthread_cond_destroy(&frame_queued);
+    pthread_mutex_destroy(&queue_lock);
+}
+
+/**
+ * Whether a frame should be written. Depends only on its arguments, so
+ * frames can be sampled before their images are final and only sampled
+ * frames need debug overlays drawn.
+ */
+bool DebugWriter::sampled(unsigned long sequence, double confidence) const
+{
+    return (every_n > 0 && sequence % every_n == 0) || confidence < min_confidence;
+}
+
+/**
+ * Copies the images of a sampled frame into the queue. The sequence number
+ * and, in multi-camera mode, the stream name go into the file names. Returns
+ * false and drops the frame if the queue is full. Only one thread may submit
+ * at a time.
+ */
+bool DebugWriter::submit(const cv::Mat& img, const cv::Mat& edges, unsigned long sequence, const string& stream)
+{
+    pthread_mutex_lock(&queue_lock);
+    if (count == (int)slots.size())
+    {
+        stats.dropped++;
+        pthread_mutex_unlock(&queue_lock);
+        return false;
+    }
+
+    struct DebugImages& images = slots[(head + count) % (int)slots.size()];
+    pthread_mutex_unlock(&queue_lock);
+
+    // the slot is not queued yet so the writer thread does not look at it.
+    // its buffers are reused once they have the frame size
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    images.stamp_ms = now.tv_sec * 1000 + now.tv_usec / 1000;
+    images.sequence = sequence;
+    images.stream = stream;
+    replace(images.stream.begin(), images.stream.end(), '/', '_');
+    img.copyTo(images.img);
+    edges.copyTo(images.edges);
+
+    pthread_mutex_lock(&queue_lock);
+    count++;
+    stats.queued++;
+    pthread_cond_signal(&frame_queued);
+    pthread_mutex_unlock(&queue_lock);
+
+    return true;
+}
+
+struct DebugWriterStats DebugWriter::get_stats()
+{
+    pthread_mutex_lock(&queue_lock);
+    struct DebugWriterStats copy = stats;
+    pthread_mutex_unlock(&queue_lock);
+
+    return copy;
+}
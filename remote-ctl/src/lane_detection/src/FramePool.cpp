@@ -0,0 +1,307 @@
+#include "FramePool.h"
+#include <stdexcept>
+#include <string>
+#include <cerrno>
+
+using namespace std;
+
+FrameHandle::FrameHandle() : pool(NULL), slot(NULL)
+{
+}
+
+FrameHandle::FrameHandle(FramePool* pool, FrameSlot* slot) : pool(pool), slot(slot)
+{
+}
+
+FrameHandle::FrameHandle(FrameHandle&& other) : pool(other.pool), slot(other.slot)
+{
+    other.pool = NULL;
+    other.slot = NULL;
+}
+
+FrameHandle& FrameHandle::operator=(FrameHandle&& other)
+{
+    if (this != &other)
+    {
+        release();
+        pool = other.pool;
+        slot = other.slot;
+        other.pool = NULL;
+        other.slot = NULL;
+    }
+
+    return *this;
+}
+
+FrameHandle::~FrameHandle()
+{
+    release();
+}
+
+void FrameHandle::release()
+{
+    if (slot)
+    {
+        pool->release(slot);
+        pool = NULL;
+        slot = NULL;
+    }
+}
+
+FramePool::FramePool(int size) : slots(size), latest(NULL), latest_consumed(true), next_sequence(1)
+{
+    if (size < 2)
+    {
+        throw invalid_argument("FramePool: at least two slots are needed to write while a frame is being read");
+    }
+
+    for (FrameSlot& slot : slots)
+    {
+        slot.sequence = 0;
+        slot.received.tv_sec = 0;
+        slot.received.tv_nsec = 0;
+        slot.stamp_ns = 0;
+        slot.refs = 0;
+    }
+
+    stats.committed = 0;
+    stats.dropped = 0;
+    stats.overwritten = 0;
+    stats.stale = 0;
+
+    int status = pthread_mutex_init(&pool_lock, NULL);
+    if (status != 0)
+    {
+        throw runtime_error(string("pthread_mutex_init: failed to initialize FramePool.pool_lock: ") + to_string(status));
+    }
+
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    status = pthread_cond_init(&frame_ready, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+
+    if (status != 0)
+    {
+        pthread_mutex_destroy(&pool_lock);
+        throw runtime_error(string("pthread_cond_init: failed to initialize FramePool.frame_ready: ") + to_string(status));
+    }
+}
+
+FramePool::~FramePool()
+{
+    pthread_cond_destroy(&frame_ready);
+    pthread_mutex_destroy(&pool_lock);
+}
+
+/**
+ * Claims a slot that no reader references for the producer to fill. Returns
+ * NULL and counts a dropped frame when every slot is in use.
+ */
+FrameSlot* FramePool::begin_write()
+{
+    FrameSlot* free_slot = NULL;
+
+    pthread_mutex_lock(&pool_lock);
+
+    for (FrameSlot& slot : slots)
+    {
+        if (slot.refs == 0 && &slot != latest)
+        {
+            free_slot = &slot;
+            free_slot->refs = 1; // held by the writer until commit
+            break;
+        }
+    }
+
+    if (!free_slot)
+    {
+        stats.dropped++;
+    }
+
+    pthread_mutex_unlock(&pool_lock);
+
+    return free_slot;
+}
+
+/**
+ * Publishes a filled slot as the latest frame. The frame it replaces is
+ * counted as overwritten if no reader ever acquired it.
+ */
+void FramePool::commit_write(FrameSlot* slot)
+{
+    pthread_mutex_lock(&pool_lock);
+
+    clock_gettime(CLOCK_MONOTONIC, &slot->received);
+    slot->sequence = next_sequence++;
+    slot->refs--;
+
+    if (latest && !latest_consumed)
+    {
+        stats.overwritten++;
+    }
+
+    latest = slot;
+    latest_consumed = false;
+    stats.committed++;
+
+    pthread_cond_broadcast(&frame_ready);
+    pthread_mutex_unlock(&pool_lock);
+}
+
+/**
+ * Returns a slot claimed by begin_write() without publishing it
+ */
+void FramePool::abort_write(FrameSlot* slot)
+{
+    pthread_mutex_lock(&pool_lock);
+    slot->refs--;
+    pthread_mutex_unlock(&pool_lock);
+}
+
+/**
+ * Acquires a reference to the most recent frame. The handle is empty if no
+ * frame has been committed yet.
+ */
+FrameHandle FramePool::acquire_latest()
+{
+    pthread_mutex_lock(&pool_lock);
+
+    FrameSlot* slot = latest;
+    if (slot)
+    {
+        slot->refs++;
+        latest_consumed = true;
+    }
+
+    pthread_mutex_unlock(&pool_lock);
+
+    return FrameHandle(slot ? this : NULL, slot);
+}
+
+/**
+ * Milliseconds since a slot was committed
+ */
+static long frame_age_ms(const FrameSlot* slot)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec - slot->received.tv_sec) * 1000L + (now.tv_nsec - slot->received.tv_nsec) / 1000000L;
+}
+
+/**
+ * Blocks until a frame with a sequence number greater than after_sequence is
+ * committed and acquires it. Frames that are already older than max_age_ms
+ * milliseconds when they are looked at are skipped and counted as stale (0
+ * disables the age check). The deadline is fixed on entry so the wait never
+ * exceeds timeout_ms; an empty handle is returned on timeout.
+ */
+FrameHandle FramePool::wait_newer(unsigned long after_sequence, int timeout_ms, int max_age_ms)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    FrameSlot* slot = NULL;
+
+    pthread_mutex_lock(&pool_lock);
+
+    while (!slot)
+    {
+        if (latest && latest->sequence > after_sequence)
+        {
+            if (max_age_ms > 0 && frame_age_ms(latest) > max_age_ms)
+            {
+                // too old to steer from. skip it and wait for its successor
+                stats.stale++;
+                latest_consumed = true;
+                after_sequence = latest->sequence;
+            }
+            else
+            {
+                slot = latest;
+                slot->refs++;
+                latest_consumed = true;
+                break;
+            }
+        }
+
+        if (pthread_cond_timedwait(&frame_ready, &pool_lock, &deadline) == ETIMEDOUT)
+        {
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&pool_lock);
+
+    return FrameHandle(slot ? this : NULL, slot);
+}
+
+/**
+ * Acquires the latest frame if its sequence number is greater than
+ * after_sequence, without waiting. after_sequence is moved up to the frame,
+ * also when the frame is skipped for being older than max_age_ms (0
+ * disables the age check), so a skipped frame is not looked at again.
+ */
+FrameHandle FramePool::take_newer(unsigned long& after_sequence, int max_age_ms)
+{
+    FrameSlot* slot = NULL;
+
+    pthread_mutex_lock(&pool_lock);
+
+    if (latest && latest->sequence > after_sequence)
+    {
+        after_sequence = latest->sequence;
+        latest_consumed = true;
+
+        if (max_age_ms > 0 && frame_age_ms(latest) > max_age_ms)
+        {
+            stats.stale++;
+        }
+        else
+        {
+            slot = latest;
+            slot->refs++;
+        }
+    }
+
+    pthread_mutex_unlock(&pool_lock);
+
+    return FrameHandle(slot ? this : NULL, slot);
+}
+
+/**
+ * Whether a frame with a sequence number greater than after_sequence has been
+ * committed
+ */
+bool FramePool::has_newer(unsigned long after_sequence)
+{
+    pthread_mutex_lock(&pool_lock);
+    bool newer = latest && latest->sequence > after_sequence;
+    pthread_mutex_unlock(&pool_lock);
+
+    return newer;
+}
+
+void FramePool::release(FrameSlot* slot)
+{
+    pthread_mutex_lock(&pool_lock);
+    slot->refs--;
+    pthread_mutex_unlock(&pool_lock);
+}
+
+struct FramePoolStats FramePool::get_stats()
+{
+    pthread_mutex_lock(&pool_lock);
+    struct FramePoolStats current = stats;
+    pthread_mutex_unlock(&pool_lock);
+
+    return current;
+}
@@ -0,0 +1,213 @@
+#include "FrameRecording.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+using namespace std;
+
+static uint64_t align_up(uint64_t offset)
+{
+    return (offset + RECORDING_ALIGN - 1) / RECORDING_ALIGN * RECORDING_ALIGN;
+}
+
+/**
+ * File offset of the first frame of a recording with max_frames index entries
+ */
+static uint64_t data_start(uint32_t max_frames)
+{
+    return align_up(sizeof(struct RecordingHeader) + (uint64_t)max_frames * sizeof(struct RecordedFrame));
+}
+
+/**
+ * Creates path, replacing any file there, and allocates capacity bytes for
+ * it. Throws if the file cannot be allocated in full, so a recording never
+ * runs out of disk halfway.
+ */
+FrameRecorder::FrameRecorder(const string& path, uint64_t capacity, uint32_t max_frames) : path(path), fd(-1),
+        base(NULL), capacity(capacity), header(NULL), index(NULL), dropped(0)
+{
+    if (max_frames == 0 || capacity <= data_start(max_frames))
+    {
+        throw runtime_error("FrameRecorder: " + path + " is too small for its index");
+    }
+
+    fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        throw runtime_error("FrameRecorder: failed to create " + path + ": " + strerror(errno));
+    }
+
+    int status = posix_fallocate(fd, 0, (off_t)capacity);
+    if (status != 0)
+    {
+        close(fd);
+        throw runtime_error("FrameRecorder: failed to allocate " + path + ": " + strerror(status));
+    }
+
+    void* mapping = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED)
+    {
+        close(fd);
+        throw runtime_error("FrameRecorder: failed to map " + path + ": " + strerror(errno));
+    }
+
+    base = (uint8_t*)mapping;
+    header = (struct RecordingHeader*)base;
+    index = (struct RecordedFrame*)(base + sizeof(struct RecordingHeader));
+
+    memset(header, 0, sizeof(struct RecordingHeader));
+    memcpy(header->magic, RECORDING_MAGIC, sizeof(RECORDING_MAGIC));
+    header->version = RECORDING_VERSION;
+    header->max_frames = max_frames;
+    header->frames = 0;
+    header->data_end = data_start(max_frames);
+}
+
+/**
+ * Unmaps the recording and cuts the file down to the frames recorded
+ */
+FrameRecorder::~FrameRecorder()
+{
+    uint64_t used = min(header->data_end, capacity);
+
+    munmap(base, capacity);
+    if (ftruncate(fd, (off_t)used) != 0)
+    {
+        printf("%s: failed to trim recording: %s\n", path.c_str(), strerror(errno));
+    }
+    close(fd);
+}
+
+/**
+ * Copies a frame into the recording. Returns false and counts the frame as
+ * dropped if the recording is full or the frame is not 8 bit bgr or mono.
+ * The index entry only counts once the pixels are in place, so a recording
+ * cut short by a crash is still consistent.
+ */
+bool FrameRecorder::append(const cv::Mat& image, unsigned long sequence, unsigned long long stamp_ns, int stream)
+{
+    uint64_t row_bytes = (uint64_t)image.cols * image.elemSize();
+    uint64_t offset = header->data_end;
+
+    if (image.depth() != CV_8U || (image.channels() != 1 && image.channels() != 3) ||
+        image.rows > UINT16_MAX || image.cols > UINT16_MAX || header->frames >= header->max_frames ||
+        offset + row_bytes * image.rows > capacity)
+    {
+        dropped++;
+        return false;
+    }
+
+    for (int row = 0; row < image.rows; row++)
+    {
+        memcpy(base + offset + row * row_bytes, image.ptr<uint8_t>(row), row_bytes);
+    }
+
+    struct RecordedFrame& entry = index[header->frames];
+    memset(&entry, 0, sizeof(entry));
+    entry.stamp_ns = stamp_ns;
+    entry.sequence = sequence;
+    entry.offset = offset;
+    entry.encoding = (uint32_t)image.type();
+    entry.rows = (uint16_t)image.rows;
+    entry.cols = (uint16_t)image.cols;
+    entry.stream = (uint16_t)stream;
+
+    header->data_end = align_up(offset + row_bytes * image.rows);
+    header->frames++;
+    return true;
+}
+
+struct RecordingStats FrameRecorder::get_stats() const
+{
+    struct RecordingStats stats;
+    stats.recorded = (unsigned long)header->frames;
+    stats.dropped = dropped;
+    stats.bytes = (unsigned long)min(header->data_end, capacity);
+
+    return stats;
+}
+
+/**
+ * Maps a recording read only. Throws if it is not a recording or any frame
+ * lies outside the file.
+ */
+FrameReplay::FrameReplay(const string& path) : fd(-1), base(NULL), length(0), header(NULL), index(NULL)
+{
+    fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        throw runtime_error("FrameReplay: failed to open " + path + ": " + strerror(errno));
+    }
+
+    struct stat file;
+    if (fstat(fd, &file) != 0 || (uint64_t)file.st_size < sizeof(struct RecordingHeader))
+    {
+        close(fd);
+        throw runtime_error("FrameReplay: " + path + " is not a recording");
+    }
+    length = (uint64_t)file.st_size;
+
+    void* mapping = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED)
+    {
+        close(fd);
+        throw runtime_error("FrameReplay: failed to map " + path + ": " + strerror(errno));
+    }
+
+    // frames are read in order, so the kernel can read ahead aggressively
+    madvise(mapping, length, MADV_SEQUENTIAL);
+
+    base = (const uint8_t*)mapping;
+    header = (const struct RecordingHeader*)base;
+    index = (const struct RecordedFrame*)(base + sizeof(struct RecordingHeader));
+
+    bool valid = memcmp(header->magic, RECORDING_MAGIC, sizeof(RECORDING_MAGIC)) == 0 &&
+                 header->version == RECORDING_VERSION && header->frames <= header->max_frames &&
+                 data_start(header->max_frames) <= length;
+
+    for (uint64_t frame = 0; valid && frame < header->frames; frame++)
+    {
+        const struct RecordedFrame& entry = index[frame];
+        uint64_t channels = entry.encoding == CV_8UC3 ? 3 : 1;
+        // written so that a corrupt offset near UINT64_MAX cannot wrap around
+        valid = (entry.encoding == CV_8UC3 || entry.encoding == CV_8UC1) && entry.offset <= length &&
+                (uint64_t)entry.rows * entry.cols * channels <= length - entry.offset;
+    }
+
+    if (!valid)
+    {
+        munmap(mapping, length);
+        close(fd);
+        throw runtime_error("FrameReplay: " + path + " is not a valid recording");
+    }
+}
+
+FrameReplay::~FrameReplay()
+{
+    munmap((void*)base, length);
+    close(fd);
+}
+
+size_t FrameReplay::size() const
+{
+    return (size_t)header->frames;
+}
+
+const struct RecordedFrame& FrameReplay::entry(size_t frame) const
+{
+    return index[frame];
+}
+
+/**
+ * The pixels of a frame, in place in the mapping
+ */
+cv::Mat FrameReplay::image(size_t frame) const
+{
+    const struct RecordedFrame& recorded = index[frame];
+    return cv::Mat(recorded.rows, recorded.cols, (int)recorded.encoding, (void*)(base + recorded.offset));
+}
@@ -0,0 +1,125 @@
+#include "FrameSource.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <strings.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "opencv2/imgproc.hpp"
+#include "opencv2/imgcodecs.hpp"
+#include "opencv2/videoio.hpp"
+
+using namespace std;
+
+static bool is_image_file(const char* name)
+{
+    const char* extensions[] = { ".jpg", ".jpeg", ".png", ".bmp", ".pgm", ".ppm" };
+    const char* dot = strrchr(name, '.');
+
+    if (!dot)
+    {
+        return false;
+    }
+
+    for (const char* extension : extensions)
+    {
+        if (strcasecmp(dot, extension) == 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Appends a frame, shrinking it to max_width pixels wide first if it is
+ * wider. Frames are never upscaled, matching what the node does.
+ */
+static void add_frame(const cv::Mat& frame, vector<cv::Mat>& frames, int max_width)
+{
+    if (max_width > 0 && frame.cols > max_width)
+    {
+        cv::Mat resized;
+        int rows = (int)((double)frame.rows * ((double)max_width / frame.cols));
+        cv::resize(frame, resized, cv::Size(max_width, rows), 0.0, 0.0, cv::INTER_AREA);
+        frames.push_back(resized);
+    }
+    else
+    {
+        frames.push_back(frame.clone());
+    }
+}
+
+/**
+ * Loads recorded frames for offline runs. path is either a directory of
+ * images, which are read in file name order, or a video file. Frames are
+ * decoded up front so that timing loops never include disk or codec time.
+ * max_frames of 0 loads everything. Returns false if nothing could be read.
+ */
+bool load_frames(const string& path, vector<cv::Mat>& frames, int max_width, int max_frames)
+{
+    struct stat path_stat;
+    if (stat(path.c_str(), &path_stat) == -1)
+    {
+        printf("%s: no such file or directory\n", path.c_str());
+        return false;
+    }
+
+    if (S_ISDIR(path_stat.st_mode))
+    {
+        DIR* dir = opendir(path.c_str());
+        if (!dir)
+        {
+            printf("%s: failed to open directory\n", path.c_str());
+            return false;
+        }
+
+        vector<string> names;
+        struct dirent* entry = NULL;
+        while ((entry = readdir(dir)) != NULL)
+        {
+            if (is_image_file(entry->d_name))
+            {
+                names.push_back(entry->d_name);
+            }
+        }
+        closedir(dir);
+
+        sort(names.begin(), names.end());
+
+        for (const string& name : names)
+        {
+            if (max_frames > 0 && (int)frames.size() >= max_frames)
+            {
+                break;
+            }
+
+            cv::Mat frame = cv::imread(path + "/" + name, cv::IMREAD_COLOR);
+            if (frame.empty())
+            {
+                printf("%s/%s: failed to decode. skipping\n", path.c_str(), name.c_str());
+                continue;
+            }
+
+            add_frame(frame, frames, max_width);
+        }
+    }
+    else
+    {
+        cv::VideoCapture video(path);
+        if (!video.isOpened())
+        {
+            printf("%s: failed to open video\n", path.c_str());
+            return false;
+        }
+
+        cv::Mat frame;
+        while ((max_frames <= 0 || (int)frames.size() < max_frames) && video.read(frame))
+        {
+            add_frame(frame, frames, max_width);
+        }
+    }
+
+    return !frames.empty();
+}
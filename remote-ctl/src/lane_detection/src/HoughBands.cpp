@@ -0,0 +1,546 @@
+#include "HoughBands.h"
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std;
+
+/**
+ * The two angle bands lane markers can appear in, one per side of the car
+ */
+const vector<struct ThetaBand>& lane_theta_bands()
+{
+    static const vector<struct ThetaBand> lane_bands = {
+        { LANE_THETA_MIN, LANE_THETA_GAP_MIN },
+        { LANE_THETA_GAP_MAX, LANE_THETA_MAX }
+    };
+
+    return lane_bands;
+}
+
+HoughBands::HoughBands() : radius_min(0.0), radius_inc(0.0), theta_inc(0.0), num_radii(0), stride(0),
+        offset_fixed(0), fixed_bits(HOUGH_FIXED_BITS), fixed_extent(0), fixed_point(false), accumulator_valid(false), frames_since_rebuild(0), edge_points(0), points_voted(0),
+        pool(NULL), num_threads(1), radius_index(1)
+{
+}
+
+/**
+ * Lets vote() split the edge points over up to num_threads threads of a
+ * worker pool, counting the calling thread. NULL votes on the caller only.
+ */
+void HoughBands::set_parallel(WorkerPool* new_pool, int new_num_threads)
+{
+    pool = new_pool;
+    num_threads = max(1, new_num_threads);
+}
+
+/**
+ * Switches voting between float and fixed-point radius computation. The two
+ * can round a point on a bin boundary differently, so switching starts the
+ * next update with a full vote.
+ */
+void HoughBands::set_fixed_point(bool enabled)
+{
+    if (enabled != fixed_point)
+    {
+        fixed_point = enabled;
+        accumulator_valid = false;
+    }
+}
+
+/**
+ * Sets up the accumulator for a set of angle bands and a radius range. The
+ * sin/cos tables are only rebuilt when something actually changed, so this
+ * can be called for every frame.
+ */
+void HoughBands::configure(const vector<struct ThetaBand>& new_bands,
+                           double new_radius_min, double radius_max,
+                           double new_radius_inc, double new_theta_inc)
+{
+    int new_num_radii = (int)ceil((radius_max - new_radius_min) / new_radius_inc) + 1;
+    bool same_bands = new_bands.size() == bands.size();
+
+    for (size_t index = 0; same_bands && index < bands.size(); index++)
+    {
+        same_bands = new_bands[index].min == bands[index].min && new_bands[index].max == bands[index].max;
+    }
+
+    if (same_bands && new_radius_min == radius_min && new_num_radii == num_radii &&
+        new_radius_inc == radius_inc && new_theta_inc == theta_inc)
+    {
+        return;
+    }
+
+    bands = new_bands;
+    radius_min = new_radius_min;
+    radius_inc = new_radius_inc;
+    theta_inc = new_theta_inc;
+    num_radii = new_num_radii;
+    stride = num_radii + 2;
+
+    // every band is surrounded by guard rows that never receive votes so
+    // peaks are not compared across bands
+    row_thetas.assign(1, -1.0);
+    for (const struct ThetaBand& band : bands)
+    {
+        int first = (int)floor(band.min / theta_inc + 1e-9) + 1;
+        int last = (int)ceil(band.max / theta_inc - 1e-9) - 1;
+
+        for (int step = first; step <= last; step++)
+        {
+            row_thetas.push_back(step * theta_inc);
+        }
+
+        row_thetas.push_back(-1.0);
+    }
+
+    cos_table.assign(row_thetas.size(), 0.0f);
+    sin_table.assign(row_thetas.size(), 0.0f);
+    vote_rows.clear();
+
+    for (size_t row = 0; row < row_thetas.size(); row++)
+    {
+        if (row_thetas[row] >= 0.0)
+        {
+            cos_table[row] = (float)(cos(row_thetas[row]) / radius_inc);
+            sin_table[row] = (float)(sin(row_thetas[row]) / radius_inc);
+            vote_rows.push_back((int)row);
+        }
+    }
+
+    // the fixed-point tables follow once the extent of the points is known
+    fixed_extent = 0;
+
+    accumulator.assign(row_thetas.size() * stride, 0);
+    accumulator_valid = false;
+}
+
+/**
+ * Scales the fixed-point sin/cos tables for coordinates up to extent. The
+ * radius x * cos + y * sin + offset has to fit 31 bits, so the tables get as
+ * many fraction bits as that allows, up to HOUGH_FIXED_BITS.
+ */
+void HoughBands::build_fixed_tables(int extent)
+{
+    double max_index = 2.0 * extent / radius_inc + num_radii + 2;
+    fixed_bits = HOUGH_FIXED_BITS;
+    while (fixed_bits > 0 && max_index * (double)(1 << fixed_bits) >= (double)INT32_MAX)
+    {
+        fixed_bits--;
+    }
+
+    double fixed_scale = (double)(1 << fixed_bits);
+    offset_fixed = (int32_t)lround((-radius_min / radius_inc + 1.5) * fixed_scale);
+    cos_fixed.assign(row_thetas.size(), 0);
+    sin_fixed.assign(row_thetas.size(), 0);
+
+    for (int row : vote_rows)
+    {
+        cos_fixed[row] = (int32_t)lround(cos(row_thetas[row]) / radius_inc * fixed_scale);
+        sin_fixed[row] = (int32_t)lround(sin(row_thetas[row]) / radius_inc * fixed_scale);
+    }
+
+    fixed_extent = extent;
+}
+
+/**
+ * Throws if the coordinates of an edge map placed at offset do not fit the
+ * 16 bit point lists, and rescales the fixed-point tables if they changed
+ */
+void HoughBands::set_extent(const cv::Mat& edges, const cv::Point& offset)
+{
+    if (offset.x < 0 || offset.y < 0 || edges.cols + offset.x > HOUGH_MAX_COORD ||
+        edges.rows + offset.y > HOUGH_MAX_COORD)
+    {
+        throw runtime_error("HoughBands: edge map coordinates do not fit 16 bits");
+    }
+
+    int extent = max(edges.cols + offset.x, edges.rows + offset.y);
+    if (extent != fixed_extent)
+    {
+        build_fixed_tables(extent);
+    }
+}
+
+/**
+ * Compacts the nonzero pixels of an edge image into coordinate lists.
+ * offset is added to every coordinate, e.g. the position of a crop.
+ */
+void HoughBands::collect_points(const cv::Mat& edges, const cv::Point& offset)
+{
+    set_extent(edges, offset);
+    xs.clear();
+    ys.clear();
+
+    for (int y = 0; y < edges.rows; y++)
+    {
+        const uchar* row = edges.ptr<uchar>(y);
+        int16_t row_y = (int16_t)(y + offset.y);
+        int x = 0;
+
+        // edge maps are mostly empty. skip zero runs eight pixels at a time
+        for (; x + 8 <= edges.cols; x += 8)
+        {
+            uint64_t chunk;
+            memcpy(&chunk, row + x, sizeof(chunk));
+            if (chunk == 0)
+            {
+                continue;
+            }
+
+            for (int index = x; index < x + 8; index++)
+            {
+                if (row[index])
+                {
+                    xs.push_back((int16_t)(index + offset.x));
+                    ys.push_back(row_y);
+                }
+            }
+        }
+
+        for (; x < edges.cols; x++)
+        {
+            if (row[x])
+            {
+                xs.push_back((int16_t)(x + offset.x));
+                ys.push_back(row_y);
+            }
+        }
+    }
+
+    radius_index[0].resize(xs.size());
+}
+
+/**
+ * Compacts the pixels that differ between an edge map and previous_edges
+ * into the appeared (xs, ys) and disappeared (gone_xs, gone_ys) lists.
+ * Coordinates get previous_offset added.
+ */
+void HoughBands::collect_changes(const cv::Mat& edges)
+{
+    xs.clear();
+    ys.clear();
+    gone_xs.clear();
+    gone_ys.clear();
+
+    for (int y = 0; y < edges.rows; y++)
+    {
+        const uchar* row = edges.ptr<uchar>(y);
+        const uchar* old_row = previous_edges.ptr<uchar>(y);
+        int16_t row_y = (int16_t)(y + previous_offset.y);
+
+        for (int x = 0; x < edges.cols; x += 8)
+        {
+            int width = min(8, edges.cols - x);
+
+            // most of the image is unchanged between frames
+            if (width == 8)
+            {
+                uint64_t chunk, old_chunk;
+                memcpy(&chunk, row + x, sizeof(chunk));
+                memcpy(&old_chunk, old_row + x, sizeof(old_chunk));
+                if (chunk == old_chunk)
+                {
+                    continue;
+                }
+            }
+
+            for (int index = x; index < x + width; index++)
+            {
+                bool is_edge = row[index] != 0;
+                bool was_edge = old_row[index] != 0;
+
+                if (is_edge && !was_edge)
+                {
+                    xs.push_back((int16_t)(index + previous_offset.x));
+                    ys.push_back(row_y);
+                }
+                else if (was_edge && !is_edge)
+                {
+                    gone_xs.push_back((int16_t)(index + previous_offset.x));
+                    gone_ys.push_back(row_y);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Adds weight votes for each of count points to one accumulator row. Radii
+ * outside the configured range land in the guard columns, which are
+ * cleared after every update. The fixed-point radius agrees with the float
+ * one except for points within a rounding error of a bin boundary.
+ */
+void HoughBands::vote_row(int row, const int16_t* x, const int16_t* y, int count, int weight, int* acc, int* index)
+{
+    const int max_index = num_radii + 1;
+    int* acc_row = acc + row * stride;
+
+    // computing indices apart from the scatter keeps these loops vectorizable
+    if (fixed_point)
+    {
+        const int32_t cos_t = cos_fixed[row];
+        const int32_t sin_t = sin_fixed[row];
+        const int shift = fixed_bits;
+
+        for (int point = 0; point < count; point++)
+        {
+            int radius = (x[point] * cos_t + y[point] * sin_t + offset_fixed) >> shift;
+            index[point] = min(max(radius, 0), max_index);
+        }
+    }
+    else
+    {
+        const float cos_t = cos_table[row];
+        const float sin_t = sin_table[row];
+        const float offset = (float)(-radius_min / radius_inc) + 1.5f; // guard column plus rounding
+
+        for (int point = 0; point < count; point++)
+        {
+            int radius = (int)((float)x[point] * cos_t + (float)y[point] * sin_t + offset);
+            index[point] = min(max(radius, 0), max_index);
+        }
+    }
+
+    for (int point = 0; point < count; point++)
+    {
+        acc_row[index[point]] += weight;
+    }
+}
+
+/**
+ * Votes every collected point over every configured angle
+ */
+void HoughBands::vote()
+{
+    accumulate(xs.data(), ys.data(), (int)xs.size(), 1, true);
+    accumulator_valid = false;
+    points_voted = (int)xs.size();
+}
+
+/**
+ * Adds weight votes for count points to the accumulator, clearing it first
+ * if asked to. Large point sets are split over the worker pool.
+ */
+void HoughBands::accumulate(const int16_t* x, const int16_t* y, int count, int weight, bool clear)
+{
+    int threads = pool ? min(num_threads, pool->size() + 1) : 1;
+    threads = max(1, min(threads, count / HOUGH_MIN_POINTS_PER_THREAD));
+
+    if (threads > 1)
+    {
+        accumulate_parallel(x, y, count, weight, clear, threads);
+    }
+    else
+    {
+        if (clear)
+        {
+            fill(accumulator.begin(), accumulator.end(), 0);
+        }
+
+        radius_index[0].resize(max((size_t)count, radius_index[0].size()));
+
+        for (int row : vote_rows)
+        {
+            vote_row(row, x, y, count, weight, accumulator.data(), radius_index[0].data());
+        }
+    }
+
+    clear_guards();
+}
+
+/**
+ * Splits the points into one contiguous slice per thread, each voting into
+ * a private accumulator, then sums the accumulators. Thread 0 votes straight
+ * into the shared accumulator. The sum is split by accumulator cells so
+ * every thread streams through one contiguous range of each private
+ * accumulator.
+ */
+void HoughBands::accumulate_parallel(const int16_t* x, const int16_t* y, int count, int weight, bool clear,
+                                     int threads)
+{
+    int cells = (int)accumulator.size();
+
+    radius_index.resize(threads);
+    worker_accumulators.resize(threads - 1);
+    for (int thread = 0; thread < threads; thread++)
+    {
+        radius_index[thread].resize(max((size_t)(count / threads + 1), radius_index[thread].size()));
+        if (thread > 0)
+        {
+            worker_accumulators[thread - 1].resize(cells);
+        }
+    }
+
+    pool->parallel_for(threads, [this, x, y, count, weight, clear, threads](int thread)
+    {
+        int* acc = thread == 0 ? accumulator.data() : worker_accumulators[thread - 1].data();
+        int begin = (int)((long)count * thread / threads);
+        int end = (int)((long)count * (thread + 1) / threads);
+
+        if (clear || thread > 0)
+        {
+            fill(acc, acc + accumulator.size(), 0);
+        }
+
+        for (int row : vote_rows)
+        {
+            vote_row(row, x + begin, y + begin, end - begin, weight, acc, radius_index[thread].data());
+        }
+    });
+
+    pool->parallel_for(threads, [this, threads, cells](int thread)
+    {
+        int begin = (int)((long)cells * thread / threads);
+        int end = (int)((long)cells * (thread + 1) / threads);
+        int* sum = accumulator.data();
+
+        for (int source = 0; source < threads - 1; source++)
+        {
+            const int* acc = worker_accumulators[source].data();
+
+            for (int cell = begin; cell < end; cell++)
+            {
+                sum[cell] += acc[cell];
+            }
+        }
+    });
+}
+
+void HoughBands::clear_guards()
+{
+    for (int row : vote_rows)
+    {
+        accumulator[row * stride] = 0;
+        accumulator[row * stride + stride - 1] = 0;
+    }
+}
+
+/**
+ * Brings the accumulator up to date with a new edge map. When the previous
+ * frame's votes are still held, only pixels that appeared or disappeared
+ * since then are voted, with +1 and -1. Votes are integers so this is exact;
+ * the accumulator is still rebuilt from scratch every rebuild_interval
+ * frames (0 never reuses votes), whenever the size, offset or configuration
+ * changed, and whenever more pixels changed than a rebuild would vote on.
+ * Returns true if the accumulator was rebuilt.
+ */
+bool HoughBands::update(const cv::Mat& edges, const cv::Point& offset, int rebuild_interval)
+{
+    bool rebuild = !accumulator_valid || rebuild_interval <= 0 ||
+                   frames_since_rebuild >= rebuild_interval ||
+                   edges.size() != previous_edges.size() || offset != previous_offset;
+
+    if (!rebuild)
+    {
+        collect_changes(edges);
+
+        int changes = (int)(xs.size() + gone_xs.size());
+        int current_points = edge_points + (int)xs.size() - (int)gone_xs.size();
+
+        if (changes < current_points)
+        {
+            accumulate(xs.data(), ys.data(), (int)xs.size(), 1, false);
+            accumulate(gone_xs.data(), gone_ys.data(), (int)gone_xs.size(), -1, false);
+            edge_points = current_points;
+            points_voted = changes;
+            frames_since_rebuild++;
+        }
+        else
+        {
+            rebuild = true;
+        }
+    }
+
+    if (rebuild)
+    {
+        collect_points(edges, offset);
+        accumulate(xs.data(), ys.data(), (int)xs.size(), 1, true);
+        edge_points = (int)xs.size();
+        points_voted = edge_points;
+        frames_since_rebuild = 0;
+    }
+
+    edges.copyTo(previous_edges);
+    previous_offset = offset;
+    accumulator_valid = true;
+
+    return rebuild;
+}
+
+/**
+ * Extracts accumulator cells with more than min_votes votes that are local
+ * maxima among their four neighbours, strongest first. Lines are
+ * (radius, theta) pairs like those from cv::HoughLines.
+ */
+void HoughBands::find_lines(int min_votes, vector<cv::Vec2d>& lines) const
+{
+    vector<pair<int, int> > peaks; // (votes, cell)
+
+    for (int row : vote_rows)
+    {
+        const int* acc_row = &accumulator[row * stride];
+
+        for (int col = 1; col <= num_radii; col++)
+        {
+            int votes = acc_row[col];
+
+            if (votes > min_votes &&
+                votes > acc_row[col - 1] && votes >= acc_row[col + 1] &&
+                votes > acc_row[col - stride] && votes >= acc_row[col + stride])
+            {
+                peaks.push_back(make_pair(-votes, row * stride + col));
+            }
+        }
+    }
+
+    sort(peaks.begin(), peaks.end());
+
+    lines.clear();
+    for (const pair<int, int>& peak : peaks)
+    {
+        int row = peak.second / stride;
+        int col = peak.second % stride;
+        lines.push_back(cv::Vec2d(radius_min + (col - 1) * radius_inc, row_thetas[row]));
+    }
+}
+
+/**
+ * Collects, votes and extracts lines in one go
+ */
+void HoughBands::detect(const cv::Mat& edges, const cv::Point& offset, int min_votes, vector<cv::Vec2d>& lines)
+{
+    collect_points(edges, offset);
+    vote();
+    find_lines(min_votes, lines);
+}
+
+/**
+ * Incremental counterpart of detect(). See update() for when votes are
+ * reused.
+ */
+void HoughBands::detect_incremental(const cv::Mat& edges, const cv::Point& offset, int min_votes,
+                                    int rebuild_interval, vector<cv::Vec2d>& lines)
+{
+    update(edges, offset, rebuild_interval);
+    find_lines(min_votes, lines);
+}
+
+/**
+ * Edge pixels behind the current votes
+ */
+int HoughBands::num_points() const
+{
+    return accumulator_valid ? edge_points : (int)xs.size();
+}
+
+/**
+ * Points voted on by the latest vote() or update(), counting both added
+ * and removed pixels for incremental updates
+ */
+int HoughBands::num_points_voted() const
+{
+    return points_voted;
+}
@@ -0,0 +1,116 @@
+#include "HoughRefine.h"
+#include <cmath>
+#include <algorithm>
+#include "opencv2/imgproc.hpp"
+
+using namespace std;
+
+/**
+ * Computes the two points where a (radius, theta) line leaves an image of
+ * the given size. Returns false if the line misses the image entirely.
+ */
+static bool line_endpoints(const cv::Size& size, const cv::Vec2d& line, cv::Point& pt1, cv::Point& pt2)
+{
+    double cos_t = cos(line[1]);
+    double sin_t = sin(line[1]);
+    double x0 = line[0] * cos_t;
+    double y0 = line[0] * sin_t;
+    double length = (double)(size.width + size.height) * 2.0;
+
+    pt1 = cv::Point((int)round(x0 - length * sin_t), (int)round(y0 + length * cos_t));
+    pt2 = cv::Point((int)round(x0 + length * sin_t), (int)round(y0 - length * cos_t));
+
+    return cv::clipLine(size, pt1, pt2);
+}
+
+/**
+ * Bounding rectangle of the pixels within band pixels of a line, clipped to
+ * an image of the given size. Empty if the line misses the image.
+ */
+cv::Rect line_band_rect(const cv::Size& size, const cv::Vec2d& line, int band)
+{
+    cv::Point pt1, pt2;
+    if (!line_endpoints(size, line, pt1, pt2))
+    {
+        return cv::Rect();
+    }
+
+    int x1 = max(min(pt1.x, pt2.x) - band, 0);
+    int y1 = max(min(pt1.y, pt2.y) - band, 0);
+    int x2 = min(max(pt1.x, pt2.x) + band + 1, size.width);
+    int y2 = min(max(pt1.y, pt2.y) + band + 1, size.height);
+
+    return cv::Rect(x1, y1, x2 - x1, y2 - y1);
+}
+
+/**
+ * Marks every pixel within band pixels of a line in an 8 bit mask
+ */
+void draw_line_band(cv::Mat& mask, const cv::Vec2d& line, int band)
+{
+    cv::Point pt1, pt2;
+    if (line_endpoints(mask.size(), line, pt1, pt2))
+    {
+        cv::line(mask, pt1, pt2, cv::Scalar(255.0), 2 * band + 1);
+    }
+}
+
+/**
+ * Re-runs the Hough vote for a single line at full resolution. Only radii
+ * within band pixels of the coarse line and angles within theta_span of it
+ * are voted on, using a 1 pixel radius step and the given theta step.
+ * points are edge pixel coordinates relative to offset. Returns the coarse
+ * line unchanged if no point votes for any candidate.
+ */
+cv::Vec2d refine_hough_line(const vector<cv::Point>& points,
+                            const cv::Point& offset,
+                            const cv::Vec2d& line,
+                            int band,
+                            double theta_span,
+                            double theta_step,
+                            int* votes)
+{
+    int half_thetas = (int)round(theta_span / theta_step);
+    int num_thetas = 2 * half_thetas + 1;
+    int num_radii = 2 * band + 1;
+    double radius_min = line[0] - band;
+
+    vector<double> cos_table(num_thetas);
+    vector<double> sin_table(num_thetas);
+    for (int t = 0; t < num_thetas; t++)
+    {
+        double theta = line[1] + (t - half_thetas) * theta_step;
+        cos_table[t] = cos(theta);
+        sin_table[t] = sin(theta);
+    }
+
+    vector<int> accumulator(num_thetas * num_radii, 0);
+
+    for (const cv::Point& point : points)
+    {
+        double x = point.x + offset.x;
+        double y = point.y + offset.y;
+
+        for (int t = 0; t < num_thetas; t++)
+        {
+            int r = (int)round(x * cos_table[t] + y * sin_table[t] - radius_min);
+            if (r >= 0 && r < num_radii)
+            {
+                accumulator[t * num_radii + r]++;
+            }
+        }
+    }
+
+    int best = (int)(max_element(accumulator.begin(), accumulator.end()) - accumulator.begin());
+    if (votes)
+    {
+        *votes = accumulator[best];
+    }
+
+    if (accumulator[best] == 0)
+    {
+        return line;
+    }
+
+    return cv::Vec2d(radius_min + best % num_radii, line[1] + (best / num_radii - half_thetas) * theta_step);
+}
@@ -0,0 +1,973 @@
+#include "LaneCore.h"
+#include <cfloat>
+#include <climits>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include "opencv2/imgproc.hpp"
+#include "HoughRefine.h"
+
+using namespace std;
+
+const char* LANE_ENGINE_NAMES[NUM_LANE_ENGINES] = { "hough", "birds_eye" };
+
+LaneParams::LaneParams() : canny_grad_thresh(80), canny_cont_thresh(30), hough_radius_inc(10),
+        hough_theta_inc(4.0 * CV_PI / 180.0), hough_min_votes(300), hough_threads(4), hough_rebuild_interval(0),
+        hough_fixed_point(false), strip_rows(0), working_width(480), refine_band(12), track_lanes(true), track_band(16),
+        track_theta_span(3.0 * CV_PI / 180.0), track_min_votes(100), track_min_confidence(0.5),
+        lane_engine(LANE_ENGINE_HOUGH), prefilter_kind(PREFILTER_DEFAULT_KIND), prefilter_size(PREFILTER_DEFAULT_SIZE),
+        qos_level(0)
+{
+}
+
+LaneCore::LaneCore(WorkerPool* pool) : pool(pool), tracking(false), verbose(true), prefilter_cache(NULL)
+{
+}
+
+/**
+ * Lightly blurred gray copy of a frame region for the refine and track
+ * passes. Luma frames skip the color conversion and blur straight into dst.
+ */
+static void blurred_gray(const cv::Mat& src, cv::Mat& dst)
+{
+    if (src.channels() == 1)
+    {
+        cv::GaussianBlur(src, dst, cv::Size(5, 5), 0.0);
+        return;
+    }
+
+    cv::cvtColor(src, dst, cv::COLOR_BGR2GRAY);
+    cv::GaussianBlur(dst, dst, cv::Size(5, 5), 0.0);
+}
+
+/**
+ * printf that only prints when verbose is set
+ */
+void LaneCore::trace(const char* format, ...) const
+{
+    if (!verbose)
+    {
+        return;
+    }
+
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+}
+
+/**
+ * Copies a frame into a workspace and starts its clock. Larger frames are
+ * reduced to the reference width but smaller ones are never upscaled. The
+ * frame is detected with snapshot, which has to outlive it, or with params
+ * if there is none.
+ */
+void LaneCore::prepare(const cv::Mat& image, struct LaneWorkspace& work, const struct LaneParams* snapshot)
+{
+    work.clock.start();
+    work.params = snapshot ? snapshot : &params;
+
+    int hres = min(image.cols, LANE_REFERENCE_WIDTH);
+    int vres = (int)((double)image.rows * ((double)hres / image.cols));
+    if (hres == image.cols)
+    {
+        image.copyTo(work.img_color);
+    }
+    else
+    {
+        cv::resize(image, work.img_color, cv::Size(hres, vres), 0.0, 0.0, cv::INTER_AREA);
+    }
+    work.clock.end_stage(STAGE_RESIZE);
+}
+
+/**
+ * Finds the lane in work.img_color with the selected engine and sets
+ * work.pose. The workspace's filters pick up configuration changes first.
+ */
+void LaneCore::detect(struct LaneWorkspace& work)
+{
+    const struct LaneParams& config = *work.params;
+    PreFilter& prefilter = work.filters->prefilter;
+    if (prefilter.get_kind() != config.prefilter_kind || prefilter.get_size() != config.prefilter_size)
+    {
+        prefilter.configure(config.prefilter_kind, config.prefilter_size);
+    }
+
+    if (config.lane_engine == LANE_ENGINE_BIRDS_EYE)
+    {
+        detect_birds_eye(work);
+    }
+    else
+    {
+        detect_hough(work);
+    }
+}
+
+double detection_confidence(const vector<cv::Vec2d>& lane_lines_left,
+        const vector<cv::Vec2d>& lane_lines_right)
+{
+    const int RADIUS_L = 0;
+    const int THETA_L = 1;
+    const int RADIUS_R = 2;
+    const int THETA_R = 3;
+    vector<double> averages = {0.0, 0.0, 0.0, 0.0};
+    vector<double> stddevs = {0.0, 0.0, 0.0, 0.0};
+
+    // calculate average radius and angles for left lane markers
+    for (const cv::Vec2d& line : lane_lines_left)
+    {
+        averages[RADIUS_L] += abs(line[0]);
+        averages[THETA_L] += line[1];
+    }
+
+    averages[RADIUS_L] /= (double)lane_lines_left.size();
+    averages[THETA_L] /= (double)lane_lines_left.size();
+
+    // calculate the average radius and angles for the right lane markers
+    for (const cv::Vec2d& line : lane_lines_right)
+    {
+        averages[RADIUS_R] += abs(line[0]);
+        averages[THETA_R] += line[1];
+    }
+
+    averages[RADIUS_R] /= (double)lane_lines_right.size();
+    averages[THETA_R] /= (double)lane_lines_right.size();
+
+    // comput standard variance / deviation for the left sample
+    for (const cv::Vec2d& line : lane_lines_left)
+    {
+        double radius_var2 = abs(line[0]) - averages[RADIUS_L];
+        double theta_var2 = line[1] - averages[THETA_L];
+        stddevs[RADIUS_L] += radius_var2 * radius_var2;
+        stddevs[THETA_L] += theta_var2 * theta_var2;
+    }
+
+    stddevs[RADIUS_L] /= (double)lane_lines_left.size();
+    stddevs[THETA_L] /= (double)lane_lines_left.size();
+
+    // compute standard variance / deviation for the right sample
+    for (const cv::Vec2d& line : lane_lines_right)
+    {
+        double radius_var2 = abs(line[0]) - averages[RADIUS_R];
+        double theta_var2 = line[1] - averages[THETA_R];
+        stddevs[RADIUS_R] += radius_var2 * radius_var2;
+        stddevs[THETA_R] += theta_var2 * theta_var2;
+    }
+
+    stddevs[RADIUS_R] /= (double)lane_lines_right.size();
+    stddevs[THETA_R] /= (double)lane_lines_right.size();
+    
+    vector<double> confidence = { 0.0, 0.0, 0.0, 0.0};
+    
+    const double P95_ANG_VARIANCE = (CV_PI * CV_PI / 4.0); // Absolute angular variance for the 95th percentile (4 sigma)
+    const double P95_RAD_VARIANCE = 2 * (150.0 * 150.0); // Absolute radial variance for the 95th percentile (4 sigma)
+    
+    // compute the confidence of lane detection. Actual lane detections should
+    // have few samples of lines and thus low variances. when variances approach
+    // the maximum possible or reasonable variance, this should drop the confidence
+    // to zero.
+    confidence[RADIUS_L] = (P95_RAD_VARIANCE - 2.0 * stddevs[RADIUS_L]) / P95_RAD_VARIANCE;
+    confidence[THETA_L] = (P95_ANG_VARIANCE - 2.0 * stddevs[THETA_L]) / P95_ANG_VARIANCE;
+    confidence[RADIUS_R] = (P95_RAD_VARIANCE - 2.0 * stddevs[RADIUS_R]) / P95_RAD_VARIANCE;
+    confidence[THETA_R] = (P95_ANG_VARIANCE - 2.0 * stddevs[THETA_R]) / P95_ANG_VARIANCE;
+    
+    if (confidence[RADIUS_L] < 0.0 || confidence[RADIUS_R] < 0.0)
+    {
+        return 0.0;
+    }
+    
+    double min_confidence = 1.0;
+    
+    // always work with minimum confidenc
+    for (int index = 0; index < 4; index++)
+    {
+        if (confidence[index] < min_confidence)
+        {
+            min_confidence = confidence[index];
+        }
+    }
+    
+    return min_confidence;
+}
+
+/**
+ * Runs the pre-filter, Canny and Hough on the road
+ * region of an image. scale is the image width relative to
+ * LANE_REFERENCE_WIDTH and is used to adapt the pixel based parameters,
+ * which are tuned at the reference width. Pixels outside the road region are
+ * never filtered and are left zero in edges.
+ */
+void LaneCore::find_lines(struct LaneWorkspace& work, const cv::Mat& img, vector<cv::Vec2d>& lines,
+        cv::Mat& edges, double scale)
+{
+    const struct LaneParams& config = *work.params;
+    double radius_inc = max(1.0, config.hough_radius_inc * scale);
+    int min_votes = max(1, (int)(config.hough_min_votes * scale));
+
+    const struct RoadMask& road = work.filters->road_region.get_mask(img.size());
+    edges.create(img.size(), CV_8U);
+    clear_outside(edges, road.crop);
+    cv::Mat road_edges = edges(road.crop);
+
+    int kernel = work.filters->prefilter.scaled_size(scale);
+    if (config.strip_rows > 0)
+    {
+        // the tiled pass interleaves the stages, so all of it counts as Canny
+        work.filters->strip_edges.configure(config.strip_rows);
+        work.filters->strip_edges.detect(work.filters->prefilter, img(road.crop), road_edges, kernel,
+                                         config.canny_cont_thresh, config.canny_grad_thresh);
+    }
+    else
+    {
+        // recorded frames may have been filtered the same way by an earlier
+        // run. they are charged what filtering cost that run
+        struct PrefilteredFrame* cached = NULL;
+        if (prefilter_cache && work.sequence >= 1 && work.sequence <= prefilter_cache->frames.size())
+        {
+            cached = &prefilter_cache->frames[work.sequence - 1];
+        }
+
+        const cv::Mat* gray = &work.img_gray;
+        if (cached && cached->gray.size() == road.crop.size())
+        {
+            gray = &cached->gray;
+            work.clock.add(STAGE_GRAY, cached->gray_ms);
+            work.clock.add(STAGE_BLUR, cached->blur_ms);
+        }
+        else
+        {
+            // convert to grayscale and remove localized noise and unnecessary detail
+            double gray_ms = work.clock.stage_ms[STAGE_GRAY];
+            double blur_ms = work.clock.stage_ms[STAGE_BLUR];
+            work.filters->prefilter.apply(img(road.crop), work.img_gray, kernel, &work.clock);
+
+            if (cached && prefilter_cache->filling)
+            {
+                work.img_gray.copyTo(cached->gray);
+                cached->gray_ms = work.clock.stage_ms[STAGE_GRAY] - gray_ms;
+                cached->blur_ms = work.clock.stage_ms[STAGE_BLUR] - blur_ms;
+            }
+        }
+
+        // perform canny edge detection straight into the road part of the
+        // edge image
+        cv::Canny(*gray, road_edges, config.canny_cont_thresh, config.canny_grad_thresh);
+    }
+
+    // drop whatever falls outside the trapezoid
+    cv::bitwise_and(road_edges, road.mask, road_edges);
+    work.clock.end_stage(STAGE_CANNY);
+
+    // only vote over the angles lane markers can have. edge pixels are offset
+    // by the crop position so lines come out in image coordinates. with a
+    // rebuild interval only the edge pixels that changed since the previous
+    // frame are voted on
+    work.filters->hough.configure(lane_theta_bands(), -img.cols, hypot((double)img.cols, (double)img.rows),
+                    radius_inc, config.hough_theta_inc);
+    work.filters->hough.set_parallel(pool, config.hough_threads);
+    work.filters->hough.set_fixed_point(config.hough_fixed_point);
+    work.filters->hough.detect_incremental(road_edges, road.crop.tl(), min_votes, config.hough_rebuild_interval,
+                                           lines);
+    work.clock.end_stage(STAGE_HOUGH);
+}
+
+/**
+ * Refines lines found on the downscaled image against full resolution edges.
+ * Edges are only computed inside bands of refine_band pixels around each
+ * candidate line that fall within the road region; edges receives those
+ * edges and is zero elsewhere.
+ */
+void LaneCore::refine_lines(struct LaneWorkspace& work, const vector<cv::Vec2d>& coarse_lines, double scale,
+        vector<cv::Vec2d>& lines, cv::Mat& edges)
+{
+    const struct LaneParams& config = *work.params;
+    const struct RoadMask& road = work.filters->road_region.get_mask(work.img_color.size());
+
+    edges.create(work.img_color.size(), CV_8U);
+    edges.setTo(cv::Scalar(0.0));
+    work.band_mask.create(work.img_color.size(), CV_8U);
+    work.band_mask.setTo(cv::Scalar(0.0));
+
+    vector<cv::Vec2d> candidates;
+    cv::Rect region;
+
+    for (const cv::Vec2d& line : coarse_lines)
+    {
+        // lines the classifier discards are not worth refining
+        if (!is_lane_angle(line[1]))
+        {
+            continue;
+        }
+
+        cv::Vec2d candidate(line[0] / scale, line[1]);
+        cv::Rect band = line_band_rect(work.img_color.size(), candidate, config.refine_band) & road.crop;
+        if (band.empty())
+        {
+            continue;
+        }
+
+        draw_line_band(work.band_mask, candidate, config.refine_band);
+        region = candidates.empty() ? band : (region | band);
+        candidates.push_back(candidate);
+    }
+
+    if (candidates.empty())
+    {
+        work.clock.end_stage(STAGE_REFINE);
+        return;
+    }
+
+    // only the part of the bands inside the road trapezoid is searched
+    clear_outside(work.band_mask, road.crop);
+    cv::Mat road_band = work.band_mask(road.crop);
+    cv::bitwise_and(road_band, road.mask, road_band);
+
+    // a light blur is enough here: the coarse pass already rejected clutter
+    blurred_gray(work.img_color(region), work.refine_gray);
+    cv::Canny(work.refine_gray, work.refine_edges, config.canny_cont_thresh, config.canny_grad_thresh);
+
+    cv::Mat edge_region = edges(region);
+    work.refine_edges.copyTo(edge_region, work.band_mask(region));
+
+    vector<cv::Point> points;
+    cv::findNonZero(edge_region, points);
+
+    for (const cv::Vec2d& candidate : candidates)
+    {
+        lines.push_back(refine_hough_line(points, region.tl(), candidate, config.refine_band,
+                                          config.hough_theta_inc, config.hough_theta_inc / REFINE_THETA_DIVISIONS));
+    }
+
+    work.clock.end_stage(STAGE_REFINE);
+}
+
+/**
+ * Searches for each predicted lane line only within track_band pixels and
+ * track_theta_span of the prediction. Gray conversion, blur and Canny run on
+ * short strips of rows following each line instead of the whole road
+ * region, so the work is proportional to the length of the lines. A line is
+ * left out of lines if it gets fewer than track_min_votes votes.
+ */
+void LaneCore::track_lines(struct LaneWorkspace& work, const cv::Vec2d predicted[NUM_LANE_SIDES],
+        vector<cv::Vec2d>& lines)
+{
+    const struct LaneParams& config = *work.params;
+    double scale = (double)work.img_color.cols / LANE_REFERENCE_WIDTH;
+    int band = max(1, (int)(config.track_band * scale));
+    int min_votes = max(1, (int)(config.track_min_votes * scale));
+    const struct RoadMask& road = work.filters->road_region.get_mask(work.img_color.size());
+    int road_bottom = road.crop.y + road.crop.height;
+
+    work.edge_img.create(work.img_color.size(), CV_8U);
+    work.edge_img.setTo(cv::Scalar(0.0));
+
+    for (int side = 0; side < NUM_LANE_SIDES; side++)
+    {
+        const cv::Vec2d& line = predicted[side];
+        if (!is_lane_angle(line[1]))
+        {
+            continue;
+        }
+
+        // lane lines are never close to horizontal, so x is a function of y
+        // and a band of half width band spans band / |cos| columns
+        double cos_t = cos(line[1]);
+        double sin_t = sin(line[1]);
+        double reach = band / fabs(cos_t) + TRACK_STRIP_MARGIN;
+        work.track_points.clear();
+
+        for (int y = road.crop.y; y < road_bottom; y += TRACK_STRIP_ROWS)
+        {
+            int y2 = min(y + TRACK_STRIP_ROWS, road_bottom);
+            double x1 = (line[0] - y * sin_t) / cos_t;
+            double x2 = (line[0] - y2 * sin_t) / cos_t;
+
+            // the margin keeps the blur and Canny borders away from the
+            // rows and columns that are kept
+            int left = (int)floor(min(x1, x2) - reach);
+            int right = (int)ceil(max(x1, x2) + reach);
+            cv::Rect strip = cv::Rect(left, y - TRACK_STRIP_MARGIN, right - left + 1,
+                                      y2 - y + 2 * TRACK_STRIP_MARGIN) & road.crop;
+            if (strip.empty())
+            {
+                continue;
+            }
+
+            blurred_gray(work.img_color(strip), work.refine_gray);
+            cv::Canny(work.refine_gray, work.refine_edges, config.canny_cont_thresh, config.canny_grad_thresh);
+
+            for (int row = y; row < y2; row++)
+            {
+                const uchar* edge_row = work.refine_edges.ptr<uchar>(row - strip.y);
+                const uchar* mask_row = road.mask.ptr<uchar>(row - road.crop.y);
+                uchar* out_row = work.edge_img.ptr<uchar>(row);
+
+                for (int x = strip.x; x < strip.x + strip.width; x++)
+                {
+                    if (edge_row[x - strip.x] && mask_row[x - road.crop.x] &&
+                        fabs(x * cos_t + row * sin_t - line[0]) <= band)
+                    {
+                        out_row[x] = 255;
+                        work.track_points.push_back(cv::Point(x, row));
+                    }
+                }
+            }
+        }
+
+        int votes = 0;
+        cv::Vec2d tracked = refine_hough_line(work.track_points, cv::Point(0, 0), line, band,
+                                              config.track_theta_span,
+                                              config.hough_theta_inc / REFINE_THETA_DIVISIONS, &votes);
+        if (votes >= min_votes)
+        {
+            lines.push_back(tracked);
+        }
+    }
+
+    work.clock.end_stage(STAGE_TRACK);
+}
+
+/**
+ * Searches the whole road region of work.img_color for lines, coarse to fine if
+ * working_width is smaller than the image
+ */
+void LaneCore::search_lines(struct LaneWorkspace& work, vector<cv::Vec2d>& lines)
+{
+    const struct LaneParams& config = *work.params;
+    int hres = work.img_color.cols;
+    int vres = work.img_color.rows;
+
+    if (config.working_width > 0 && config.working_width < hres)
+    {
+        // coarse to fine: find candidate lines on a small copy of the frame
+        // and only go back to full resolution around those candidates
+        double scale = (double)config.working_width / hres;
+        cv::resize(work.img_color, work.img_coarse, cv::Size(config.working_width, (int)(vres * scale)), 0.0, 0.0, cv::INTER_AREA);
+        work.clock.end_stage(STAGE_RESIZE);
+
+        vector<cv::Vec2d> coarse_lines;
+        find_lines(work, work.img_coarse, coarse_lines, work.edge_coarse, (double)config.working_width / LANE_REFERENCE_WIDTH);
+        refine_lines(work, coarse_lines, scale, lines, work.edge_img);
+    }
+    else
+    {
+        find_lines(work, work.img_color, lines, work.edge_img, (double)hres / LANE_REFERENCE_WIDTH);
+    }
+}
+
+/**
+ * Converts a (radius, theta) line to (slope, y intercept)
+ */
+static cv::Vec2d slope_intercept(const cv::Vec2d& line)
+{
+    double slope = -1.0 / tan(line[1]);
+    double y_init = line[0] * sin(line[1]);
+    double x_init = line[0] * cos(line[1]);
+
+    return cv::Vec2d(slope, -slope * x_init + y_init);
+}
+
+/**
+ * Mean (radius, theta) of a set of lines
+ */
+static cv::Vec2d mean_line(const vector<cv::Vec2d>& lines)
+{
+    cv::Vec2d mean(0.0, 0.0);
+
+    for (const cv::Vec2d& line : lines)
+    {
+        mean[0] += line[0];
+        mean[1] += line[1];
+    }
+
+    mean[0] /= (double)lines.size();
+    mean[1] /= (double)lines.size();
+    return mean;
+}
+
+/**
+ * Splits lines at lane angles into the left and right lane line by the sign
+ * of their slope and keeps them as debug overlays
+ */
+void LaneCore::classify_lines(struct LaneWorkspace& work, const vector<cv::Vec2d>& lines,
+        vector<cv::Vec2d>& raw_lines_left, vector<cv::Vec2d>& raw_lines_right)
+{
+    trace("Found %lu lines in the image\n", lines.size());
+
+    for (auto& line : lines)
+    {
+        trace("  Radius: %f    Theta: %f\n", line[0], line[1] / CV_PI * 180.0);
+
+        if (is_lane_angle(line[1]))
+        {
+            cv::Vec2d lane_line = slope_intercept(line);
+            double slope = lane_line[0];
+            double x1, y1, x2, y2 = 0.0;
+
+            x1 = 0.0;
+            y1 = lane_line[1];
+
+            if (slope < 0.0)
+            {
+                x2 = -lane_line[1] / slope;
+                y2 = 0.0;
+                raw_lines_left.push_back(line);
+            }
+            else
+            {
+                x2 = (double)work.edge_img.cols;
+                y2 = slope * x2 + lane_line[1];
+                raw_lines_right.push_back(line);
+            }
+
+            struct DebugLine overlay = { cv::Point2i((int)x1, (int)y1), cv::Point2i((int)x2, (int)y2), 10 };
+            work.debug_lines.push_back(overlay);
+
+            trace("  (%f, %f), (%f, %f)\n", x1, y1, x2, y2);
+        }
+    }
+}
+
+/**
+ * Hough engine: finds straight lane lines on the perspective image, following
+ * them with the tracker when enabled, and sets work.pose. The lines have
+ * no geometric model so heading and curvature are not known.
+ */
+void LaneCore::detect_hough(struct LaneWorkspace& work)
+{
+    const struct LaneParams& config = *work.params;
+
+    // tracking switched off by a hot reload starts over from scratch, so no
+    // stale lines are reported once it is switched back on. untracked frames
+    // never write tracking, which keeps frame-parallel detection off the
+    // tracker
+    if (config.track_lanes != tracking)
+    {
+        tracking = config.track_lanes;
+        if (!tracking)
+        {
+            tracker.reset();
+        }
+    }
+
+    // while the tracker is locked only the neighbourhood of the predicted
+    // lines is searched. if that is not convincing the same frame is
+    // searched in full
+    cv::Vec2d predicted[NUM_LANE_SIDES];
+    bool tracked = config.track_lanes && tracker.predict(work.img_color.size(), predicted);
+    vector<cv::Vec2d> raw_lines_left;
+    vector<cv::Vec2d> raw_lines_right;
+    double confidence = 0.0;
+
+    for (;;)
+    {
+        vector<cv::Vec2d> lines;
+        raw_lines_left.clear();
+        raw_lines_right.clear();
+        work.debug_lines.clear();
+
+        if (tracked)
+        {
+            track_lines(work, predicted, lines);
+        }
+        else
+        {
+            search_lines(work, lines);
+        }
+
+        classify_lines(work, lines, raw_lines_left, raw_lines_right);
+        work.clock.end_stage(STAGE_CLASSIFY);
+
+        confidence = raw_lines_left.empty() || raw_lines_right.empty() ? 0.0 :
+                     detection_confidence(raw_lines_left, raw_lines_right);
+        work.clock.end_stage(STAGE_CONFIDENCE);
+
+        if (!tracked || confidence >= config.track_min_confidence)
+        {
+            break;
+        }
+
+        trace("Lost the lane track, searching the whole frame\n");
+        tracker.reset();
+        tracked = false;
+    }
+
+    if (config.track_lanes)
+    {
+        if (confidence >= config.track_min_confidence)
+        {
+            cv::Vec2d measured[NUM_LANE_SIDES] = { mean_line(raw_lines_left), mean_line(raw_lines_right) };
+            tracker.correct(work.img_color.size(), measured);
+        }
+        else
+        {
+            tracker.reset();
+        }
+    }
+
+    if (!raw_lines_left.empty() && !raw_lines_right.empty())
+    {
+        cv::Vec2d lane_left(0.0, 0.0);
+        cv::Vec2d lane_right(0.0, 0.0);
+
+        // report the filtered lines once tracking has settled, otherwise the
+        // mean of the lines found on this frame
+        if (config.track_lanes && tracker.locked())
+        {
+            lane_left = slope_intercept(tracker.get_line(LANE_LEFT));
+            lane_right = slope_intercept(tracker.get_line(LANE_RIGHT));
+        }
+        else
+        {
+            for (const cv::Vec2d& line : raw_lines_left)
+            {
+                lane_left += slope_intercept(line);
+            }
+
+            for (const cv::Vec2d& line : raw_lines_right)
+            {
+                lane_right += slope_intercept(line);
+            }
+
+            lane_left[0] /= (double)raw_lines_left.size();
+            lane_left[1] /= (double)raw_lines_left.size();
+            lane_right[0] /= (double)raw_lines_right.size();
+            lane_right[1] /= (double)raw_lines_right.size();
+        }
+
+        int lane_start_y = work.edge_img.rows;
+        int lane_left_start_x = ((double)lane_start_y - lane_left[1]) / lane_left[0];
+        int lane_right_start_x = ((double)lane_start_y - lane_right[1]) / lane_right[0];
+        int lane_center = lane_left_start_x + ((double)lane_right_start_x - lane_left_start_x) / 2.0;
+        int xint = (lane_right[1] - lane_left[1]) / (lane_left[0] - lane_right[0]);
+        int yint = lane_right[0] * xint + lane_right[1];
+
+        struct DebugLine overlay = { cv::Point2i(xint, yint), cv::Point2i(lane_center, lane_start_y), 5 };
+        work.debug_lines.push_back(overlay);
+
+        trace("\n  Distance from Center: %d px\n"
+               "  Right / Left X: %d, %d\n", work.edge_img.cols / 2 - lane_center, lane_right_start_x, lane_left_start_x);
+        
+        struct LanePose pose;
+        // offsets are always reported in reference width pixels
+        pose.center_offset = (work.edge_img.cols / 2 - lane_center) * LANE_REFERENCE_WIDTH / work.edge_img.cols;
+        pose.heading = 0.0;
+        pose.curvature = 0.0;
+        pose.confidence = confidence;
+        work.pose = pose;
+
+        trace("  Detection Confidence: %%%3.1f%s\n", pose.confidence * 100.0, tracked ? " (tracked)" : "");
+    }
+    else
+    {
+        struct LanePose pose;
+        pose.center_offset = 0;
+        pose.heading = 0.0;
+        pose.curvature = 0.0;
+        pose.confidence = 0.0;
+        work.pose = pose;
+    }
+
+    work.clock.end_stage(STAGE_CLASSIFY);
+}
+
+/**
+ * Bird's eye engine: fits both lane lines on a top down view of the road
+ * and sets work.pose, including the heading and curvature of the lane
+ */
+void LaneCore::detect_birds_eye(struct LaneWorkspace& work)
+{
+    const struct LaneParams& config = *work.params;
+    struct LaneFit fit;
+    work.filters->birds_eye.detect(work.img_color, config.canny_cont_thresh, config.canny_grad_thresh, fit,
+                                   &work.clock);
+
+    // the debug image is the top down view, copied only for sampled frames
+    work.fit = fit;
+
+    struct LanePose pose;
+    pose.center_offset = fit.found ? work.filters->birds_eye.offset_pixels(fit.center_offset, LANE_REFERENCE_WIDTH) : 0;
+    pose.heading = fit.heading;
+    pose.curvature = fit.curvature;
+    pose.confidence = fit.confidence;
+    work.pose = pose;
+
+    trace("Lane windows left / right: %d, %d\n", fit.left_windows, fit.right_windows);
+    if (fit.found)
+    {
+        trace("  Distance from Center: %.3f m\n"
+               "  Heading: %.2f deg   Curvature: %.3f 1/m\n"
+               "  Detection Confidence: %%%3.1f\n",
+               fit.center_offset, fit.heading / CV_PI * 180.0, fit.curvature, fit.confidence * 100.0);
+    }
+
+    work.clock.end_stage(STAGE_CLASSIFY);
+}
+
+/**
+ * Draws the detected lane onto the debug edge image. Needs the engine's
+ * buffers, so it runs on the detecting thread right after detection.
+ */
+void LaneCore::draw_debug(struct LaneWorkspace& work)
+{
+    const struct LaneParams& config = *work.params;
+    if (config.lane_engine == LANE_ENGINE_BIRDS_EYE)
+    {
+        work.filters->birds_eye.get_edges().copyTo(work.edge_img);
+        work.filters->birds_eye.draw(work.edge_img, work.fit);
+        return;
+    }
+
+    for (const struct DebugLine& overlay : work.debug_lines)
+    {
+        cv::line(work.edge_img, overlay.from, overlay.to, cv::Scalar(255.0), overlay.thickness);
+    }
+}
+
+/**
+ * Selects the lane engine by name. Returns false and keeps the current
+ * engine if the name is unknown.
+ */
+bool LaneParams::set_lane_engine(const string& name)
+{
+    for (int engine = 0; engine < NUM_LANE_ENGINES; engine++)
+    {
+        if (name == LANE_ENGINE_NAMES[engine])
+        {
+            lane_engine = (enum LaneEngine)engine;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void LaneParams::set_hough_theta_inc(double degrees)
+{
+    hough_theta_inc = degrees * CV_PI / 180.0;
+}
+
+
+/**
+ * Selects the pre-filter run ahead of Canny and its kernel size in pixels at
+ * LANE_REFERENCE_WIDTH. Returns false if the size is not valid for the kind.
+ */
+bool LaneParams::set_prefilter(enum PreFilterKind kind, int size)
+{
+    if (!PreFilter::valid(kind, size))
+    {
+        return false;
+    }
+
+    prefilter_kind = kind;
+    prefilter_size = size;
+    return true;
+}
+
+/**
+ * Sets a tuning field by the name of its node parameter. Angles are given in
+ * degrees and the pre-filter by kind name. Returns false and changes nothing
+ * if the name is unknown, the value does not parse or it is out of range, so
+ * a bad value from a config file or the lane_params topic never reaches the
+ * detector.
+ */
+bool LaneParams::set_option(const string& name, const string& value)
+{
+    struct IntOption
+    {
+        const char* name;
+        int* field;
+        long min;
+        long max;
+    };
+
+    struct IntOption int_options[] = {
+        { "canny_grad_thresh", &canny_grad_thresh, 0, INT_MAX },
+        { "canny_cont_thresh", &canny_cont_thresh, 0, INT_MAX },
+        { "hough_radius_inc", &hough_radius_inc, 1, INT_MAX },
+        { "hough_min_votes", &hough_min_votes, 1, INT_MAX },
+        { "hough_threads", &hough_threads, 1, LANE_MAX_HOUGH_THREADS },
+        { "hough_rebuild_interval", &hough_rebuild_interval, 0, INT_MAX },
+        { "strip_rows", &strip_rows, 0, INT_MAX },
+        { "working_width", &working_width, 0, INT_MAX },
+        { "refine_band", &refine_band, 1, INT_MAX },
+        { "track_band", &track_band, 1, INT_MAX },
+        { "track_min_votes", &track_min_votes, 1, INT_MAX },
+    };
+
+    struct DoubleOption
+    {
+        const char* name;
+        double min; ///< exclusive
+        double max; ///< inclusive
+    };
+
+    // angles in degrees, as they are given
+    struct DoubleOption double_options[] = {
+        { "prefilter_size", 0.0, INT_MAX },
+        { "hough_theta_inc", 0.0, 90.0 },
+        { "track_theta_span", 0.0, 90.0 },
+        { "track_min_confidence", -DBL_MAX, 1.0 },
+    };
+
+    struct BoolOption
+    {
+        const char* name;
+        bool* field;
+    };
+
+    struct BoolOption bool_options[] = {
+        { "hough_fixed_point", &hough_fixed_point },
+        { "track_lanes", &track_lanes },
+    };
+
+    const char* text = value.c_str();
+    char* end = NULL;
+
+    for (const struct IntOption& option : int_options)
+    {
+        if (name == option.name)
+        {
+            long parsed = strtol(text, &end, 10);
+            if (end == text || *end != '\0' || parsed < option.min || parsed > option.max)
+            {
+                return false;
+            }
+
+            *option.field = (int)parsed;
+            return true;
+        }
+    }
+
+    if (name == "lane_engine")
+    {
+        return set_lane_engine(value);
+    }
+
+    if (name == "prefilter")
+    {
+        for (int kind = 0; kind < NUM_PREFILTER_KINDS; kind++)
+        {
+            if (value == PREFILTER_NAMES[kind])
+            {
+                return set_prefilter((enum PreFilterKind)kind, prefilter_size);
+            }
+        }
+
+        return false;
+    }
+
+    for (const struct BoolOption& option : bool_options)
+    {
+        if (name == option.name)
+        {
+            if (value != "true" && value != "false")
+            {
+                return false;
+            }
+
+            *option.field = value == "true";
+            return true;
+        }
+    }
+
+    double parsed = strtod(text, &end);
+    if (end == text || *end != '\0')
+    {
+        return false;
+    }
+
+    for (const struct DoubleOption& option : double_options)
+    {
+        // written so that nan fails too
+        if (name == option.name && !(parsed > option.min && parsed <= option.max))
+        {
+            return false;
+        }
+    }
+
+    if (name == "prefilter_size")
+    {
+        return set_prefilter(prefilter_kind, (int)parsed);
+    }
+    else if (name == "hough_theta_inc")
+    {
+        set_hough_theta_inc(parsed);
+    }
+    else if (name == "track_theta_span")
+    {
+        track_theta_span = parsed * CV_PI / 180.0;
+    }
+    else if (name == "track_min_confidence")
+    {
+        track_min_confidence = parsed;
+    }
+    else
+    {
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Applies one point of a configuration file written by lane_bench tune.
+ * Points start with a "point <n>" line, followed by "<name> <value>" lines
+ * using the set_option() names. # starts a comment. Returns false if the file
+ * or the point is missing or a setting is invalid; settings before the bad
+ * one stay applied.
+ */
+bool LaneParams::load_config(const string& path, int point)
+{
+    FILE* file = fopen(path.c_str(), "r");
+    if (!file)
+    {
+        printf("%s: failed to open lane config\n", path.c_str());
+        return false;
+    }
+
+    int current = -1;
+    bool found = false;
+    bool valid = true;
+    char line[256];
+
+    while (valid && fgets(line, sizeof(line), file))
+    {
+        char name[64];
+        char value[64];
+        if (line[strspn(line, " \t")] == '#' || sscanf(line, "%63s %63s", name, value) != 2)
+        {
+            continue;
+        }
+
+        if (strcmp(name, "point") == 0)
+        {
+            current = atoi(value);
+            found = found || current == point;
+        }
+        else if (current == point && !set_option(name, value))
+        {
+            printf("%s: invalid setting %s %s\n", path.c_str(), name, value);
+            valid = false;
+        }
+    }
+
+    fclose(file);
+
+    if (valid && !found)
+    {
+        printf("%s: no point %d in lane config\n", path.c_str(), point);
+    }
+
+    return valid && found;
+}
+
+/**
+ * Forgets the lane lines followed so far, e.g. before a new recording
+ */
+void LaneCore::reset()
+{
+    tracker.reset();
+}
@@ -1,69 +1,533 @@
 #include "LaneDetector.h"
 #include <errno.h>
 #include <poll.h>
+#include <sched.h>
+#include <unistd.h>
+#include <chrono>
 #include <cmath>
+#include <sstream>
 #include "sensor_msgs/Image.h"
-#include "std_msgs/ColorRGBA.h"
+#include "lane_detection/LanePose.h"
+#include "sensor_msgs/image_encodings.h"
 #include "cv_bridge/cv_bridge.h"
 
 using namespace std;
 
-cv::Mat* current_img = NULL;
-pthread_rwlock_t imgproc_semaphore = PTHREAD_RWLOCK_INITIALIZER;
+const char* PIPELINE_STAGE_NAMES[NUM_PIPELINE_STAGES] = { "prepare", "detect", "output" };
 
-void img_listener(const sensor_msgs::Image& img)
+void* lane_detection_loop(void* detector_ptr)
 {
-    // printf("new image\n");
-    pthread_rwlock_wrlock(&imgproc_semaphore);
-    // copy the image onto the heap meaning it can exist without the global binding
-    current_img = new cv::Mat(cv_bridge::toCvCopy(img, string("bgr8"))->image);
-    pthread_rwlock_unlock(&imgproc_semaphore);
+    LaneDetector* detector = (LaneDetector*)detector_ptr;
+    unsigned long last_sequence = 0;
+
+    // processing is driven by frame arrival: take the newest frame as soon as
+    // it is committed. the timeout only bounds how long a shutdown takes
+    while (detector->is_running())
+    {
+        FrameHandle frame = detector->frame_pool.wait_newer(last_sequence,
+                                                             FRAME_WAIT_TIMEOUT_MS,
+                                                             detector->max_frame_age_ms);
+
+        if (frame)
+        {
+            last_sequence = frame->sequence;
+            detector->detect_lane(frame);
+        }
+    }
+
+    return NULL;
 }
 
-void* lane_detection_loop(void* detector_ptr)
+/**
+ * Restricts the calling thread to one core. Failure only costs performance so
+ * it is reported and otherwise ignored.
+ */
+static void pin_to_core(int core)
+{
+    cpu_set_t cores;
+    CPU_ZERO(&cores);
+    CPU_SET(core % max(1, (int)sysconf(_SC_NPROCESSORS_ONLN)), &cores);
+
+    int status = pthread_setaffinity_np(pthread_self(), sizeof(cores), &cores);
+    if (status != 0)
+    {
+        printf("pthread_setaffinity_np: failed to pin pipeline stage to core %d: %d\n", core, status);
+    }
+}
+
+static unsigned long elapsed_us(const chrono::steady_clock::time_point& start)
+{
+    return (unsigned long)chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * Pipelined mode, first stage: fills free workspaces with the newest frames
+ * and passes them on to the detect stage. Waiting for a free workspace
+ * means the later stages are behind and counts as a stall.
+ */
+void* lane_prepare_loop(void* detector_ptr)
+{
+    LaneDetector* detector = (LaneDetector*)detector_ptr;
+    struct PipelineCounters& counters = detector->pipeline_counters[PIPELINE_PREPARE];
+    unsigned long last_sequence = 0;
+
+    if (detector->pipeline_pin_cores)
+    {
+        pin_to_core(PIPELINE_PREPARE);
+    }
+
+    while (struct LaneWorkspace* work = detector->pipeline_take(detector->free_queue, counters))
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        FrameHandle frame;
+
+        while (!frame && detector->is_running())
+        {
+            frame = detector->frame_pool.wait_newer(last_sequence, FRAME_WAIT_TIMEOUT_MS, detector->max_frame_age_ms);
+        }
+
+        counters.stall_us += elapsed_us(start);
+        if (!frame)
+        {
+            break;
+        }
+
+        start = chrono::steady_clock::now();
+        last_sequence = frame->sequence;
+        detector->prepare_frame(frame, *work);
+
+        // every queue can hold every workspace, so pushing never fails
+        detector->detect_queue.try_push(work);
+        counters.busy_us += elapsed_us(start);
+        counters.frames++;
+    }
+
+    return NULL;
+}
+
+/**
+ * Pipelined mode, second stage: runs the lane engine on prepared frames in
+ * the order they were prepared
+ */
+void* lane_detect_loop(void* detector_ptr)
 {
     LaneDetector* detector = (LaneDetector*)detector_ptr;
+    struct PipelineCounters& counters = detector->pipeline_counters[PIPELINE_DETECT];
 
-    pthread_rwlock_rdlock(&detector->exit_semaphore);
-    bool running = detector->running;
-    pthread_rwlock_unlock(&detector->exit_semaphore);
+    if (detector->pipeline_pin_cores)
+    {
+        pin_to_core(PIPELINE_DETECT);
+    }
 
-    while (running)
+    while (struct LaneWorkspace* work = detector->pipeline_take(detector->detect_queue, counters))
     {
-        struct timeval now;
-        gettimeofday(&now, NULL);
-        unsigned long start_time = now.tv_sec * 1000 + now.tv_usec / 1000;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+        // time spent queued is not charged to the frame's stages
+        work->clock.resume();
+        detector->detect_frame(*work);
+        detector->output_queue.try_push(work);
+
+        counters.busy_us += elapsed_us(start);
+        counters.frames++;
+    }
+
+    return NULL;
+}
 
-        detector->detect_lane();
+/**
+ * Pipelined mode, last stage: writes debug images, publishes and recycles
+ * the workspace
+ */
+void* lane_output_loop(void* detector_ptr)
+{
+    LaneDetector* detector = (LaneDetector*)detector_ptr;
+    struct PipelineCounters& counters = detector->pipeline_counters[PIPELINE_OUTPUT];
 
-        gettimeofday(&now, NULL);
-        unsigned long end_time = now.tv_sec * 1000 + now.tv_usec / 1000;
+    if (detector->pipeline_pin_cores)
+    {
+        pin_to_core(PIPELINE_OUTPUT);
+    }
 
-        usleep(1000000 - ((end_time - start_time) * 1000));
+    while (struct LaneWorkspace* work = detector->pipeline_take(detector->output_queue, counters))
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+        work->clock.resume();
+        detector->output_frame(*work);
+        detector->free_queue.try_push(work);
 
-        pthread_rwlock_rdlock(&detector->exit_semaphore);
-        running = detector->running;
-        pthread_rwlock_unlock(&detector->exit_semaphore);
+        counters.busy_us += elapsed_us(start);
+        counters.frames++;
     }
 
     return NULL;
 }
 
-LaneDetector::LaneDetector() : running(true), median_blur_radius(25), rosnode(ros::NodeHandle()),
-        canny_grad_thresh(80), canny_cont_thresh(30), hough_radius_inc(10),
-        hough_theta_inc(4.0 * CV_PI / 180.0), hough_min_votes(300)
+/**
+ * Frame-parallel mode: prepares every new frame into a free workspace and
+ * hands its detection to the worker pool, so up to parallel_frames
+ * consecutive frames are processed at once. finish_parallel_frame()
+ * publishes the results in frame order.
+ */
+void* lane_parallel_loop(void* detector_ptr)
 {
-    laneimg_listener = rosnode.subscribe("camera/rgb/image_rect_color", 2, img_listener);
-    pose_publisher = rosnode.advertise<std_msgs::ColorRGBA>("lane_pose", 2);
+    LaneDetector* detector = (LaneDetector*)detector_ptr;
+    unsigned long last_sequence = 0;
+
+    while (struct LaneWorkspace* work = detector->take_free_workspace())
+    {
+        FrameHandle frame;
+
+        while (!frame && detector->is_running())
+        {
+            frame = detector->frame_pool.wait_newer(last_sequence, FRAME_WAIT_TIMEOUT_MS, detector->max_frame_age_ms);
+        }
+
+        if (!frame)
+        {
+            detector->recycle_workspace(work);
+            break;
+        }
+
+        last_sequence = frame->sequence;
+        detector->prepare_frame(frame, *work);
+        detector->start_parallel_frame(work);
+        detector->worker_pool.submit([detector, work]()
+        {
+            work->clock.resume();
+            detector->detect_frame(*work);
+            detector->finish_parallel_frame(work);
+        });
+    }
+
+    // workers still hold workspaces and must finish before they go away
+    detector->wait_parallel_idle();
+    return NULL;
+}
+
+/**
+ * Reads a road region from roi_* parameters under node. Missing parameters
+ * keep the values already in roi.
+ */
+static void read_road_region(ros::NodeHandle& node, struct RoadRegionConfig& roi)
+{
+    node.param("roi_top", roi.top, roi.top);
+    node.param("roi_top_left", roi.top_left, roi.top_left);
+    node.param("roi_top_right", roi.top_right, roi.top_right);
+    node.param("roi_bottom_left", roi.bottom_left, roi.bottom_left);
+    node.param("roi_bottom_right", roi.bottom_right, roi.bottom_right);
+}
+
+/**
+ * Reads a top down view calibration from bev_* parameters under node.
+ * Missing parameters keep the values already in view.
+ */
+static void read_birds_eye(ros::NodeHandle& node, struct BirdsEyeConfig& view)
+{
+    node.param("bev_top", view.ground.top, view.ground.top);
+    node.param("bev_top_left", view.ground.top_left, view.ground.top_left);
+    node.param("bev_top_right", view.ground.top_right, view.ground.top_right);
+    node.param("bev_bottom_left", view.ground.bottom_left, view.ground.bottom_left);
+    node.param("bev_bottom_right", view.ground.bottom_right, view.ground.bottom_right);
+    node.param("bev_view_width", view.view_width, view.view_width);
+    node.param("bev_view_length", view.view_length, view.view_length);
+}
+
+LaneDetector::LaneDetector() : running(true), worker_pool(max(0, (int)sysconf(_SC_NPROCESSORS_ONLN) - 1)),
+        pipelined(false), pipeline_pin_cores(false), free_queue(PIPELINE_WORKSPACES),
+        detect_queue(PIPELINE_WORKSPACES), output_queue(PIPELINE_WORKSPACES), parallel_frames(1),
+        recorder(NULL), camera_streams(NULL), debug_writer(NULL), latency_publish_period(5.0), luma_only(false),
+        qos(NULL), qos_level(0), rosnode(ros::NodeHandle()), core(&worker_pool),
+        strip_threads(0), max_frame_age_ms(200)
+{
+    ros::NodeHandle private_node("~");
+
+    // detector tuning picked by lane_bench tune. the parameters below still
+    // override it
+    string tuned_config;
+    int tuned_point = 0;
+    private_node.param("tuned_config", tuned_config, tuned_config);
+    private_node.param("tuned_point", tuned_point, tuned_point);
+    if (!tuned_config.empty() && !core.params.load_config(tuned_config, tuned_point))
+    {
+        throw runtime_error(string("LaneDetector: failed to load tuned config ") + tuned_config);
+    }
+
+    // the road region depends on how the camera is mounted
+    struct RoadRegionConfig roi = RoadRegion().get_config();
+    read_road_region(private_node, roi);
+
+    private_node.param("hough_threads", core.params.hough_threads, core.params.hough_threads);
+    private_node.param("hough_rebuild_interval", core.params.hough_rebuild_interval,
+                       core.params.hough_rebuild_interval);
+    private_node.param("hough_fixed_point", core.params.hough_fixed_point, core.params.hough_fixed_point);
+
+    // strip tiling keeps each band of the road region in cache through gray
+    // conversion, pre-filter and Canny
+    private_node.param("strip_rows", core.params.strip_rows, core.params.strip_rows);
+    private_node.param("strip_threads", strip_threads, strip_threads);
+    if (strip_threads > 0)
+    {
+        cv::setNumThreads(strip_threads);
+    }
+    private_node.param("track_lanes", core.params.track_lanes, core.params.track_lanes);
+    private_node.param("track_band", core.params.track_band, core.params.track_band);
+    private_node.param("track_min_votes", core.params.track_min_votes, core.params.track_min_votes);
+    private_node.param("track_min_confidence", core.params.track_min_confidence,
+                       core.params.track_min_confidence);
+
+    string engine_name;
+    private_node.param("lane_engine", engine_name, string(LANE_ENGINE_NAMES[core.params.lane_engine]));
+    if (!core.params.set_lane_engine(engine_name))
+    {
+        printf("Unknown lane engine %s, using %s\n", engine_name.c_str(),
+               LANE_ENGINE_NAMES[core.params.lane_engine]);
+    }
+
+    // the top down view is calibrated separately from the road region
+    struct BirdsEyeConfig view = BirdsEye().get_config();
+    read_birds_eye(private_node, view);
+
+    // several cameras, named by ~cameras, share the worker pool instead of
+    // each getting a detection thread. every camera has its own frame slots,
+    // tracker and tuning and publishes <camera>/lane_pose
+    string camera_list;
+    private_node.param("cameras", camera_list, camera_list);
+    vector<string> cameras;
+    istringstream camera_names(camera_list);
+    for (string name; camera_names >> name; )
+    {
+        cameras.push_back(name);
+    }
+    if (!cameras.empty() && worker_pool.size() == 0)
+    {
+        printf("no worker threads for multi-camera mode, detecting the default camera only\n");
+        cameras.clear();
+    }
+
+    // pipelined mode runs prepare, detect and output on their own threads,
+    // passing PIPELINE_WORKSPACES workspaces around a ring of queues.
+    // frame-parallel mode detects several frames at once on the worker pool
+    // instead, each with its own filters
+    private_node.param("pipeline", pipelined, pipelined);
+    private_node.param("pipeline_pin_cores", pipeline_pin_cores, pipeline_pin_cores);
+    private_node.param("frame_parallel", parallel_frames, parallel_frames);
+    parallel_frames = max(1, parallel_frames);
+    if (!cameras.empty() && (pipelined || parallel_frames > 1))
+    {
+        printf("~pipeline and ~frame_parallel are ignored in multi-camera mode\n");
+        pipelined = false;
+        parallel_frames = 1;
+    }
+    if (parallel_frames > 1 && worker_pool.size() == 0)
+    {
+        printf("no worker threads for frame-parallel mode, detecting one frame at a time\n");
+        parallel_frames = 1;
+    }
+    if (parallel_frames > 1 && pipelined)
+    {
+        printf("~pipeline is ignored in frame-parallel mode\n");
+        pipelined = false;
+    }
+
+    // frames processed in parallel do not finish in order, so they are not
+    // tracked
+    if (parallel_frames > 1)
+    {
+        core.params.track_lanes = false;
+    }
+
+    filter_sets.resize(parallel_frames);
+    for (struct LaneFilters& filters : filter_sets)
+    {
+        filters.road_region.configure(roi);
+        filters.birds_eye.configure(view);
+    }
+
+    workspaces.resize(pipelined ? PIPELINE_WORKSPACES : parallel_frames);
+    for (size_t index = 0; index < workspaces.size(); index++)
+    {
+        workspaces[index].filters = &filter_sets[index % filter_sets.size()];
+        workspaces[index].done = false;
+
+        if (pipelined)
+        {
+            free_queue.try_push(&workspaces[index]);
+        }
+        else if (parallel_frames > 1)
+        {
+            free_workspaces.push_back(&workspaces[index]);
+        }
+    }
+
+    // with a frame deadline, frames that keep missing it degrade the tuning
+    // a level at a time and frames with room to spare restore it
+    double qos_deadline_ms = 0.0;
+    private_node.param("qos_deadline_ms", qos_deadline_ms, qos_deadline_ms);
+    if (qos_deadline_ms > 0.0)
+    {
+        qos = new QosController(qos_deadline_ms);
+        if (!qos_supported(core.params))
+        {
+            printf("QoS has no effect on the %s engine until it is switched\n",
+                   LANE_ENGINE_NAMES[core.params.lane_engine]);
+        }
+    }
+
+    // frames take their tuning from live_params when they are prepared.
+    // params_in_use records the snapshot each workspace holds, so a replaced
+    // snapshot is only freed once no workspace can still be reading it
+    base_params = core.params;
+    live_params.store(new LaneParams(core.params));
+    params_in_use = vector<atomic<const struct LaneParams*> >(workspaces.size());
+    for (atomic<const struct LaneParams*>& slot : params_in_use)
+    {
+        slot.store(NULL);
+    }
+    if (pthread_mutex_init(&params_lock, NULL) != 0)
+    {
+        throw runtime_error("LaneDetector: failed to initialize the parameter lock");
+    }
+
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    if (pthread_mutex_init(&reorder_lock, NULL) != 0 || pthread_mutex_init(&publish_lock, NULL) != 0 ||
+        pthread_cond_init(&workspace_free, &cond_attr) != 0)
+    {
+        pthread_condattr_destroy(&cond_attr);
+        throw runtime_error("LaneDetector: failed to initialize the reorder buffer");
+    }
+    pthread_condattr_destroy(&cond_attr);
+    reorder_stats.started = 0;
+    reorder_stats.published = 0;
+    reorder_stats.superseded = 0;
+
+    // debug images of every Nth frame and of low confidence frames are
+    // written in the background. both at 0 turns debug images off
+    string debug_dir = "/media/nvidia/seniorDesign/LaneDetectionDebug";
+    int debug_every = 30;
+    double debug_min_confidence = 0.3;
+    int debug_queue = DEBUG_WRITER_DEFAULT_QUEUE;
+    private_node.param("debug_dir", debug_dir, debug_dir);
+    private_node.param("debug_every", debug_every, debug_every);
+    private_node.param("debug_min_confidence", debug_min_confidence, debug_min_confidence);
+    private_node.param("debug_queue", debug_queue, debug_queue);
+    if (debug_every > 0 || debug_min_confidence > 0.0)
+    {
+        debug_writer = new DebugWriter(debug_dir, debug_every, debug_min_confidence, debug_queue);
+    }
+
+    // raw frames exactly as the detector gets them, for lane_bench replay.
+    // the file is allocated up front; frames that do not fit are dropped
+    string record_path;
+    int record_size_mb = RECORDING_DEFAULT_MB;
+    int record_max_frames = RECORDING_DEFAULT_FRAMES;
+    private_node.param("record_path", record_path, record_path);
+    private_node.param("record_size_mb", record_size_mb, record_size_mb);
+    private_node.param("record_max_frames", record_max_frames, record_max_frames);
+    if (!record_path.empty())
+    {
+        recorder = new FrameRecorder(record_path, (uint64_t)max(1, record_size_mb) << 20,
+                                     (uint32_t)max(1, record_max_frames));
+    }
+
+    // the lane engines only need luma. a mono topic saves the driver's color
+    // conversion too. with ~luma_topic empty the color topic is reduced here
+    string luma_topic = "camera/rgb/image_rect_mono";
+    private_node.param("luma_only", luma_only, luma_only);
+    private_node.param("luma_topic", luma_topic, luma_topic);
+    string image_topic = "camera/rgb/image_rect_color";
+    if (luma_only && !luma_topic.empty())
+    {
+        image_topic = luma_topic;
+    }
+
+    if (!cameras.empty())
+    {
+        start_cameras(cameras, roi, view);
+    }
+    else
+    {
+        laneimg_listener = rosnode.subscribe(image_topic, 2, &LaneDetector::img_listener, this);
+        pose_publisher = rosnode.advertise<lane_detection::LanePose>("lane_pose", 2);
+    }
+
+    // settings published as key/value pairs, named like the ~ parameters,
+    // take effect from the next frame without restarting the node
+    params_listener = rosnode.subscribe("lane_params", 10, &LaneDetector::param_listener, this);
+
+    // stage latency percentiles go out on the standard diagnostics topic
+    private_node.param("latency_publish_period", latency_publish_period, latency_publish_period);
+    diagnostics_publisher = rosnode.advertise<diagnostic_msgs::DiagnosticArray>("diagnostics", 1);
+
+    // pthread functions return their error instead of setting errno
+    int status = pthread_rwlock_init(&exit_semaphore, NULL);
+    if (status != 0)
+    {
+        throw runtime_error(string("pthread_rwlock_init: failed to initialize LaneDetector.exit_semaphore: ") + to_string(status));
+    }
+
+    if (pipelined)
+    {
+        status = pthread_create(&output_thread, NULL, &lane_output_loop, (void*)this);
+        if (status != 0)
+        {
+            throw runtime_error(string("pthread_create(): failed to start pipeline output thread: ") + to_string(status));
+        }
+
+        status = pthread_create(&detect_thread, NULL, &lane_detect_loop, (void*)this);
+        if (status != 0)
+        {
+            stop_pipeline(false);
+            throw runtime_error(string("pthread_create(): failed to start pipeline detect thread: ") + to_string(status));
+        }
+    }
 
-    if (pthread_rwlock_init(&exit_semaphore, NULL) == -1)
+    // in multi-camera mode the camera listeners schedule all the work
+    if (camera_streams)
     {
-        throw runtime_error(string("pthread_rwlock_init: failed to initialize LaneDetector.exit_semaphore: ") + to_string(errno));
+        return;
     }
 
-    if (pthread_create(&lane_detection_thread, NULL, &lane_detection_loop, (void*)this) == -1)
+    void* (*loop)(void*) = &lane_detection_loop;
+    if (pipelined)
+    {
+        loop = &lane_prepare_loop;
+    }
+    else if (parallel_frames > 1)
     {
-        throw runtime_error(string("pthread_create(): failed to start background processing thread: ") + to_string(errno));
+        loop = &lane_parallel_loop;
+    }
+
+    status = pthread_create(&lane_detection_thread, NULL, loop, (void*)this);
+    if (status != 0)
+    {
+        stop_pipeline(true);
+        throw runtime_error(string("pthread_create(): failed to start background processing thread: ") + to_string(status));
+    }
+}
+
+/**
+ * Constructor failure path: the destructor will not run, so the pipeline
+ * stage threads already started are stopped and joined here before the
+ * object goes away. The stages poll their queues and see the cleared
+ * running flag within PIPELINE_POLL_US.
+ */
+void LaneDetector::stop_pipeline(bool detect_started)
+{
+    pthread_rwlock_wrlock(&exit_semaphore);
+    running = false;
+    pthread_rwlock_unlock(&exit_semaphore);
+
+    if (pipelined)
+    {
+        if (detect_started)
+        {
+            pthread_join(detect_thread, NULL);
+        }
+        pthread_join(output_thread, NULL);
     }
 }
 
@@ -73,300 +537,906 @@ LaneDetector::~LaneDetector()
     running = false;
     pthread_rwlock_unlock(&exit_semaphore);
 
-    pthread_join(lane_detection_thread, NULL);
+    if (camera_streams)
+    {
+        // waits for the detection jobs still queued on the worker pool
+        delete camera_streams;
+    }
+    else
+    {
+        pthread_join(lane_detection_thread, NULL);
+    }
+    if (pipelined)
+    {
+        pthread_join(detect_thread, NULL);
+        pthread_join(output_thread, NULL);
+    }
+    // every thread that records frames or QoS is gone now
+    delete recorder;
+    delete qos;
+    for (QosController* controller : camera_qos)
+    {
+        delete controller;
+    }
+
+    // flushes the queued debug images
+    delete debug_writer;
+
+    delete live_params.load();
+    for (const struct LaneParams* snapshot : retired_params)
+    {
+        delete snapshot;
+    }
+    pthread_mutex_destroy(&params_lock);
+
+    pthread_cond_destroy(&workspace_free);
+    pthread_mutex_destroy(&publish_lock);
+    pthread_mutex_destroy(&reorder_lock);
+}
+
+bool LaneDetector::is_running()
+{
+    pthread_rwlock_rdlock(&exit_semaphore);
+    bool result = running;
+    pthread_rwlock_unlock(&exit_semaphore);
+
+    return result;
 }
 
-double detection_confidence(const vector<cv::Vec2d>& lane_lines_left,
-        const vector<cv::Vec2d>& lane_lines_right)
+/**
+ * Frame-parallel mode: waits for a workspace no frame is using. Returns NULL
+ * once the detector is shutting down.
+ */
+struct LaneWorkspace* LaneDetector::take_free_workspace()
 {
-    const int RADIUS_L = 0;
-    const int THETA_L = 1;
-    const int RADIUS_R = 2;
-    const int THETA_R = 3;
-    vector<double> averages = {0.0, 0.0, 0.0, 0.0};
-    vector<double> stddevs = {0.0, 0.0, 0.0, 0.0};
+    struct LaneWorkspace* work = NULL;
 
-    // calculate average radius and angles for left lane markers
-    for (const cv::Vec2d& line : lane_lines_left)
+    pthread_mutex_lock(&reorder_lock);
+    while (free_workspaces.empty() && is_running())
     {
-        averages[RADIUS_L] += abs(line[0]);
-        averages[THETA_L] += line[1];
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_nsec += FRAME_WAIT_TIMEOUT_MS * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        pthread_cond_timedwait(&workspace_free, &reorder_lock, &deadline);
     }
 
-    averages[RADIUS_L] /= (double)lane_lines_left.size();
-    averages[THETA_L] /= (double)lane_lines_left.size();
+    if (!free_workspaces.empty() && is_running())
+    {
+        work = free_workspaces.back();
+        free_workspaces.pop_back();
+    }
+    pthread_mutex_unlock(&reorder_lock);
 
-    // calculate the average radius and angles for the right lane markers
-    for (const cv::Vec2d& line : lane_lines_right)
+    return work;
+}
+
+/**
+ * Frame-parallel mode: returns a workspace to the free list. Caller must not
+ * hold reorder_lock.
+ */
+void LaneDetector::recycle_workspace(struct LaneWorkspace* work)
+{
+    pthread_mutex_lock(&reorder_lock);
+    work->done = false;
+    free_workspaces.push_back(work);
+    pthread_cond_signal(&workspace_free);
+    pthread_mutex_unlock(&reorder_lock);
+}
+
+/**
+ * Frame-parallel mode: appends a prepared frame to the reorder buffer. Frames
+ * are started in sequence order, so the buffer is in sequence order.
+ */
+void LaneDetector::start_parallel_frame(struct LaneWorkspace* work)
+{
+    pthread_mutex_lock(&reorder_lock);
+    reorder_buffer.push_back(work);
+    reorder_stats.started++;
+    pthread_mutex_unlock(&reorder_lock);
+}
+
+/**
+ * Frame-parallel mode: called by a worker once a frame is detected. Frames
+ * leave the reorder buffer from the front once they and every earlier frame
+ * are done. Of the frames leaving together only the newest is published; the
+ * older ones are superseded and dropped. A frame finishing ahead of an
+ * earlier one waits in the buffer and is released by the worker that
+ * finishes the earlier frame. Publishing holds publish_lock, which is taken
+ * before reorder_lock is let go, so releases publish in buffer order.
+ */
+void LaneDetector::finish_parallel_frame(struct LaneWorkspace* work)
+{
+    struct LaneWorkspace* newest = NULL;
+
+    pthread_mutex_lock(&reorder_lock);
+    work->done = true;
+
+    while (!reorder_buffer.empty() && reorder_buffer.front()->done)
     {
-        averages[RADIUS_R] += abs(line[0]);
-        averages[THETA_R] += line[1];
+        if (newest)
+        {
+            newest->done = false;
+            free_workspaces.push_back(newest);
+            pthread_cond_signal(&workspace_free);
+            reorder_stats.superseded++;
+        }
+
+        newest = reorder_buffer.front();
+        reorder_buffer.pop_front();
+    }
+
+    if (!newest)
+    {
+        pthread_mutex_unlock(&reorder_lock);
+        return;
     }
 
-    averages[RADIUS_R] /= (double)lane_lines_right.size();
-    averages[THETA_R] /= (double)lane_lines_right.size();
+    pthread_mutex_lock(&publish_lock);
+    reorder_stats.published++;
+    pthread_mutex_unlock(&reorder_lock);
 
-    // comput standard variance / deviation for the left sample
-    for (const cv::Vec2d& line : lane_lines_left)
+    newest->clock.resume();
+    output_frame(*newest);
+    pthread_mutex_unlock(&publish_lock);
+
+    recycle_workspace(newest);
+}
+
+/**
+ * Frame-parallel mode: waits until the workers have handed back every
+ * workspace
+ */
+void LaneDetector::wait_parallel_idle()
+{
+    pthread_mutex_lock(&reorder_lock);
+    while (free_workspaces.size() < workspaces.size())
     {
-        double radius_var2 = abs(line[0]) - averages[RADIUS_L];
-        double theta_var2 = line[1] - averages[THETA_L];
-        stddevs[RADIUS_L] += radius_var2 * radius_var2;
-        stddevs[THETA_L] += theta_var2 * theta_var2;
+        pthread_cond_wait(&workspace_free, &reorder_lock);
     }
+    pthread_mutex_unlock(&reorder_lock);
+}
 
-    stddevs[RADIUS_L] /= (double)lane_lines_left.size();
-    stddevs[THETA_L] /= (double)lane_lines_left.size();
+/**
+ * Takes the next workspace off a pipeline queue for a stage, waiting as long
+ * as it takes. The wait is charged to the stage's stall time and the queue
+ * depth is sampled. Waiting yields the core for the first
+ * PIPELINE_SPIN_TRIES tries and then sleeps PIPELINE_POLL_US at a time.
+ * Returns NULL once the detector is shutting down.
+ */
+struct LaneWorkspace* LaneDetector::pipeline_take(SpscQueue<struct LaneWorkspace*>& queue,
+        struct PipelineCounters& counters)
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    struct LaneWorkspace* work = NULL;
+    unsigned long depth = (unsigned long)queue.size();
 
-    // compute standard variance / deviation for the right sample
-    for (const cv::Vec2d& line : lane_lines_right)
+    for (int tries = 0; !queue.try_pop(work); tries++)
     {
-        double radius_var2 = abs(line[0]) - averages[RADIUS_R];
-        double theta_var2 = line[1] - averages[THETA_R];
-        stddevs[RADIUS_R] += radius_var2 * radius_var2;
-        stddevs[THETA_R] += theta_var2 * theta_var2;
+        if (!is_running())
+        {
+            return NULL;
+        }
+
+        if (tries < PIPELINE_SPIN_TRIES)
+        {
+            sched_yield();
+        }
+        else
+        {
+            usleep(PIPELINE_POLL_US);
+        }
+    }
+
+    // an empty queue counts as depth one: the workspace that ended the wait
+    depth = max(depth, 1UL);
+    counters.stall_us += elapsed_us(start);
+    counters.depth_sum += depth;
+    if (depth > counters.max_depth)
+    {
+        counters.max_depth = depth;
+    }
+
+    return work;
+}
+
+/**
+ * Copies the luma of a camera frame into a single channel image. The Y plane
+ * of packed YUV 4:2:2 and the gray demosaic of Bayer frames are taken straight
+ * from the message buffer; other encodings go through cv_bridge.
+ */
+static void copy_luma(const sensor_msgs::ImageConstPtr& img, cv::Mat& luma)
+{
+    namespace encodings = sensor_msgs::image_encodings;
+    void* data = (void*)&img->data[0];
+    int bayer_code = -1;
+
+    if (img->encoding == encodings::YUV422 || img->encoding == "yuv422_yuy2")
+    {
+        // UYVY keeps luma in the odd bytes, YUYV in the even ones
+        cv::Mat packed(img->height, img->width, CV_8UC2, data, img->step);
+        cv::extractChannel(packed, luma, img->encoding == encodings::YUV422 ? 1 : 0);
+        return;
+    }
+
+    // OpenCV names Bayer patterns by the second row, ROS by the first
+    if (img->encoding == encodings::BAYER_RGGB8)
+    {
+        bayer_code = cv::COLOR_BayerBG2GRAY;
+    }
+    else if (img->encoding == encodings::BAYER_BGGR8)
+    {
+        bayer_code = cv::COLOR_BayerRG2GRAY;
+    }
+    else if (img->encoding == encodings::BAYER_GBRG8)
+    {
+        bayer_code = cv::COLOR_BayerGR2GRAY;
+    }
+    else if (img->encoding == encodings::BAYER_GRBG8)
+    {
+        bayer_code = cv::COLOR_BayerGB2GRAY;
     }
 
-    stddevs[RADIUS_R] /= (double)lane_lines_right.size();
-    stddevs[THETA_R] /= (double)lane_lines_right.size();
-    
-    vector<double> confidence = { 0.0, 0.0, 0.0, 0.0};
-    
-    const double P95_ANG_VARIANCE = (CV_PI * CV_PI / 4.0); // Absolute angular variance for the 95th percentile (4 sigma)
-    const double P95_RAD_VARIANCE = 2 * (150.0 * 150.0); // Absolute radial variance for the 95th percentile (4 sigma)
-    
-    // compute the confidence of lane detection. Actual lane detections should
-    // have few samples of lines and thus low variances. when variances approach
-    // the maximum possible or reasonable variance, this should drop the confidence
-    // to zero.
-    confidence[RADIUS_L] = (P95_RAD_VARIANCE - 2.0 * stddevs[RADIUS_L]) / P95_RAD_VARIANCE;
-    confidence[THETA_L] = (P95_ANG_VARIANCE - 2.0 * stddevs[THETA_L]) / P95_ANG_VARIANCE;
-    confidence[RADIUS_R] = (P95_RAD_VARIANCE - 2.0 * stddevs[RADIUS_R]) / P95_RAD_VARIANCE;
-    confidence[THETA_R] = (P95_ANG_VARIANCE - 2.0 * stddevs[THETA_R]) / P95_ANG_VARIANCE;
-    
-    if (confidence[RADIUS_L] < 0.0 || confidence[RADIUS_R] < 0.0)
+    if (bayer_code >= 0)
     {
-        return 0.0;
+        cv::Mat raw(img->height, img->width, CV_8UC1, data, img->step);
+        cv::cvtColor(raw, luma, bayer_code);
+        return;
     }
-    
-    double min_confidence = 1.0;
-    
-    // always work with minimum confidenc
-    for (int index = 0; index < 4; index++)
+
+    // shares the message buffer when it is already mono8
+    cv_bridge::toCvShare(img, string("mono8"))->image.copyTo(luma);
+}
+
+/**
+ * Converts a camera frame into a frame slot. Returns false if the frame
+ * cannot be converted.
+ */
+static bool fill_slot(const sensor_msgs::ImageConstPtr& img, bool luma_only, FrameSlot* slot)
+{
+    try
     {
-        if (confidence[index] < min_confidence)
+        // copy straight into the slot, which reuses its allocation for same
+        // sized frames. the bgr8 path shares the message buffer when it can
+        if (luma_only)
+        {
+            copy_luma(img, slot->image);
+        }
+        else
         {
-            min_confidence = confidence[index];
+            cv_bridge::CvImageConstPtr shared = cv_bridge::toCvShare(img, string("bgr8"));
+            shared->image.copyTo(slot->image);
         }
+        slot->stamp_ns = img->header.stamp.toNSec();
+    }
+    catch (exception& exc)
+    {
+        printf("Failed to convert camera frame: %s\n", exc.what());
+        return false;
     }
-    
-    return min_confidence;
+
+    return true;
 }
 
-void LaneDetector::detect_lane()
+void LaneDetector::img_listener(const sensor_msgs::ImageConstPtr& img)
 {
-    pthread_rwlock_rdlock(&imgproc_semaphore);
+    // printf("new image\n");
+    FrameSlot* slot = frame_pool.begin_write();
+    if (!slot)
+    {
+        return; // every slot is being read. counted as a dropped frame
+    }
 
-    if (!current_img)
+    if (!fill_slot(img, luma_only, slot))
     {
-        pthread_rwlock_unlock(&imgproc_semaphore);
-        printf("No image to process. Sleeping\n");
-        std_msgs::ColorRGBA mesg;
-        mesg.r = 0;
-        mesg.b = 0;
+        frame_pool.abort_write(slot);
         return;
     }
 
-    // get the most recent image and allow for the background listener to overwrite the binding
-    // this avoids blocking the listener while processing images
-    cv::Mat* source_img = current_img;
-    cv::Mat& img_color = *current_img;
-    pthread_rwlock_unlock(&imgproc_semaphore);
+    frame_pool.commit_write(slot);
+
+    // the listener is the only writer, so the slot stays as committed
+    if (recorder)
+    {
+        recorder->append(slot->image, slot->sequence, slot->stamp_ns);
+    }
+}
+
+/**
+ * Multi-camera mode: stores a frame of one camera in its stream, which
+ * schedules its detection on the worker pool
+ */
+void LaneDetector::camera_listener(const sensor_msgs::ImageConstPtr& img, int camera)
+{
+    struct LaneStream& stream = (*camera_streams)[camera];
+    FrameSlot* slot = stream.frames.begin_write();
+    if (!slot)
+    {
+        return;
+    }
 
-    int hres = 1280;
-    int vres = (int)((double)img_color.rows * ((double)hres / img_color.cols));
-    cv::resize(img_color, img_color, cv::Size(hres, vres), cv::INTER_AREA);
+    if (!fill_slot(img, luma_only, slot))
+    {
+        stream.frames.abort_write(slot);
+        return;
+    }
 
-    struct timeval now;
-    gettimeofday(&now, NULL);
-    unsigned long start_time = now.tv_sec * 1000 + now.tv_usec / 1000;
+    camera_streams->commit_frame(stream, slot);
 
-    // remove localized noise and unnecessary detail using median filter
-    cv::medianBlur(img_color, img_color, median_blur_radius);
+    if (recorder)
+    {
+        recorder->append(slot->image, slot->sequence, slot->stamp_ns, camera);
+    }
+}
 
-    // convert image to grayscale
-    cv::Mat img_gray;
-    cv::cvtColor(img_color, img_gray, cv::COLOR_BGR2GRAY);
+/**
+ * Multi-camera mode: sets up a stream per camera. Each camera starts from the
+ * node's tuning, road region and top down view and overrides them with the
+ * same parameters under ~<camera>/, where ~<camera>/tuned_config picks a
+ * lane_bench tune config of its own. Frames come from ~<camera>/image_topic.
+ */
+void LaneDetector::start_cameras(const vector<string>& cameras, const struct RoadRegionConfig& roi,
+                                 const struct BirdsEyeConfig& view)
+{
+    camera_streams = new LaneStreams(worker_pool, [this](struct LaneStream& stream) { output_stream(stream); });
+    camera_streams->max_frame_age_ms = max_frame_age_ms;
 
-    // perform canny edge detection
-    cv::Mat edge_img;
-    cv::Canny(img_gray, edge_img, canny_cont_thresh, canny_grad_thresh);
+    for (const string& name : cameras)
+    {
+        ros::NodeHandle camera_node(ros::NodeHandle("~"), name);
+        struct LaneStream& stream = camera_streams->add_stream(name);
+        stream.core.params = core.params;
+        stream.core.verbose = false;
+
+        string tuned_config;
+        int tuned_point = 0;
+        camera_node.param("tuned_config", tuned_config, tuned_config);
+        camera_node.param("tuned_point", tuned_point, tuned_point);
+        if (!tuned_config.empty() && !stream.core.params.load_config(tuned_config, tuned_point))
+        {
+            throw runtime_error(string("LaneDetector: failed to load tuned config ") + tuned_config + " of " + name);
+        }
 
-    // blot out top half of image
-    cv::rectangle(edge_img,
-                  cv::Point2i(0, 0),
-                  cv::Point2i(img_gray.cols - 1, img_gray.rows / 3),
-                  cv::Scalar(0.0),
-                  cv::FILLED);
+        struct RoadRegionConfig camera_roi = roi;
+        struct BirdsEyeConfig camera_view = view;
+        read_road_region(camera_node, camera_roi);
+        read_birds_eye(camera_node, camera_view);
+        stream.filters.road_region.configure(camera_roi);
+        stream.filters.birds_eye.configure(camera_view);
 
-    vector<cv::Vec2d> lines;
-    // 25.0 pix radius granularity, 1 deg angular granularity, 200 votes min for a line
-    // 200 pixels min for a segment, up to 300 pixels between disconnected colinear segments
-    cv::HoughLines(edge_img, lines, hough_radius_inc, hough_theta_inc, hough_min_votes);
+        camera_params.push_back(stream.core.params);
+        if (qos)
+        {
+            camera_qos.push_back(new QosController(qos->get_deadline()));
+        }
 
-    printf("Found %lu lines in the image\n", lines.size());
-    vector<cv::Vec2d> raw_lines_left;
-    vector<cv::Vec2d> raw_lines_right;
-    vector<cv::Vec2d> lane_lines_left;
-    vector<cv::Vec2d> lane_lines_right;
+        // listeners only run from lane_guidance(), once every stream is added
+        string image_topic = name + (luma_only ? "/image_rect_mono" : "/image_rect_color");
+        camera_node.param("image_topic", image_topic, image_topic);
 
-    for (auto& line : lines)
+        int index = stream.index;
+        camera_publishers.push_back(rosnode.advertise<lane_detection::LanePose>(name + "/lane_pose", 2));
+        camera_listeners.push_back(rosnode.subscribe<sensor_msgs::Image>(image_topic, 2,
+                [this, index](const sensor_msgs::ImageConstPtr& img) { camera_listener(img, index); }));
+        printf("Camera %s: frames from %s\n", name.c_str(), image_topic.c_str());
+    }
+}
+
+/**
+ * Multi-camera mode: runs on a worker once a frame of a stream is detected.
+ * Streams finish on different workers at once, so the debug writer, which
+ * takes one frame at a time, is fed under publish_lock.
+ */
+void LaneDetector::output_stream(struct LaneStream& stream)
+{
+    struct LaneWorkspace& work = stream.work;
+
+    work.debug_sampled = debug_writer && debug_writer->sampled(work.sequence, work.pose.confidence);
+    if (work.debug_sampled)
+    {
+        stream.core.draw_debug(work);
+
+        pthread_mutex_lock(&publish_lock);
+        debug_writer->submit(work.img_color, work.edge_img, work.sequence, stream.name);
+        pthread_mutex_unlock(&publish_lock);
+    }
+    work.clock.end_stage(STAGE_DEBUG);
+
+    // the first camera steers
+    if (stream.index == 0)
+    {
+        current_pose = work.pose;
+    }
+
+    lane_detection::LanePose mesg;
+    mesg.header.seq = work.sequence;
+    mesg.header.stamp.fromNSec(work.stamp_ns);
+    mesg.header.frame_id = stream.name;
+    mesg.processed = ros::Time::now();
+    mesg.center_offset = work.pose.center_offset;
+    mesg.heading = work.pose.heading;
+    mesg.curvature = work.pose.curvature;
+    mesg.confidence = work.pose.confidence;
+    mesg.qos_level = work.params->qos_level;
+    camera_publishers[stream.index].publish(mesg);
+    work.clock.end_stage(STAGE_PUBLISH);
+
+    // the stream's next frame is not prepared before this returns, so its
+    // tuning can be changed in place
+    if (!camera_qos.empty() && record_qos(*camera_qos[stream.index], work, stream.name + ": "))
+    {
+        qos_params(camera_params[stream.index], camera_qos[stream.index]->get_level(), stream.core.params);
+    }
+}
+
+/**
+ * First stage: copies the frame into a workspace and hands the slot straight
+ * back so the listener is never blocked by processing
+ */
+void LaneDetector::prepare_frame(FrameHandle& frame, struct LaneWorkspace& work)
+{
+    // frames are stamped on CLOCK_MONOTONIC when committed, which is the
+    // clock steady_clock reads on Linux
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double wait_ms = (now.tv_sec - frame->received.tv_sec) * 1000.0 +
+                     (now.tv_nsec - frame->received.tv_nsec) / 1000000.0;
+
+    work.sequence = frame->sequence;
+    work.stamp_ns = frame->stamp_ns;
+    core.prepare(frame->image, work, acquire_params(work));
+    work.clock.add(STAGE_WAIT, wait_ms);
+    frame.release();
+}
+
+/**
+ * Second stage: finds the lane in work.img_color. Engines keep state between
+ * frames, so outside frame-parallel mode this stage always runs on one
+ * thread at a time, in frame order.
+ */
+void LaneDetector::detect_frame(struct LaneWorkspace& work)
+{
+    core.detect(work);
+
+    // overlays are only worth drawing on frames that are written out
+    work.debug_sampled = debug_writer && debug_writer->sampled(work.sequence, work.pose.confidence);
+    if (work.debug_sampled)
     {
-        printf("  Radius: %f    Theta: %f\n", line[0], line[1] / CV_PI * 180.0);
+        core.draw_debug(work);
+    }
+    work.clock.end_stage(STAGE_DEBUG);
+}
+
+/**
+ * Last stage: queues the debug images of sampled frames and publishes the
+ * pose
+ */
+void LaneDetector::output_frame(struct LaneWorkspace& work)
+{
+    current_pose = work.pose;
 
-        if ((line[1] > 7.0 * CV_PI / 180.0) && (line[1] < 173.0 * CV_PI / 180.0) &&
-            ((line[1] < 8.0 * CV_PI / 18.0) || (line[1] > 10.0 * CV_PI / 18.0)))
+    // encoding and writing happen on the writer thread. the frame is
+    // dropped if the writer is behind
+    if (work.debug_sampled)
+    {
+        debug_writer->submit(work.img_color, work.edge_img, work.sequence);
+    }
+    work.clock.end_stage(STAGE_DEBUG);
+
+    // the header carries the camera stamp so consumers can tell how old the
+    // pose is and drop stale ones
+    lane_detection::LanePose mesg;
+    mesg.header.seq = work.sequence;
+    mesg.header.stamp.fromNSec(work.stamp_ns);
+    mesg.processed = ros::Time::now();
+    mesg.center_offset = work.pose.center_offset;
+    mesg.heading = work.pose.heading;
+    mesg.curvature = work.pose.curvature;
+    mesg.confidence = work.pose.confidence;
+    mesg.qos_level = work.params->qos_level;
+    pose_publisher.publish(mesg);
+    work.clock.end_stage(STAGE_PUBLISH);
+
+    // stages a frame never went through are left out of their histogram
+    for (int stage = 0; stage < NUM_LANE_STAGES; stage++)
+    {
+        if (work.clock.stage_ms[stage] > 0.0)
         {
-            double slope = -1.0 / tan(line[1]);
-            double y_init = line[0] * sin(line[1]);
-            double x_init = line[0] * cos(line[1]);
-            double x1, y1, x2, y2 = 0.0;
+            stage_latency[stage].record(work.clock.stage_ms[stage]);
+        }
+    }
+    frame_latency.record(work.clock.total_ms());
 
-            x1 = 0.0;
-            y1 = -slope * x_init + y_init;
+    // only one frame is output at a time, so the controller needs no lock
+    if (qos && record_qos(*qos, work, ""))
+    {
+        pthread_mutex_lock(&params_lock);
+        qos_level = qos->get_level();
+        publish_params();
+        pthread_mutex_unlock(&params_lock);
+    }
 
-            if (slope < 0.0)
-            {
-                x2 = -y_init / slope + x_init;
-                y2 = 0.0;
-                lane_lines_left.push_back(cv::Vec2d(slope, -slope * x_init + y_init));
-                raw_lines_left.push_back(line);
-            }
-            else
-            {
-                x2 = (double)edge_img.cols;
-                y2 = slope * x2 - slope * x_init + y_init;
-                lane_lines_right.push_back(cv::Vec2d(slope, -slope * x_init + y_init));
-                raw_lines_right.push_back(line);
-            }
+    work.clock.print();
+    printf("\n----\n\n");
+}
 
-            cv::line(edge_img,
-                     cv::Point2i((int)x1, (int)y1),
-                     cv::Point2i((int)x2, (int)y2),
-                     cv::Scalar(255.0),
-                     10);
+/**
+ * Runs every stage of one frame on the calling thread
+ */
+void LaneDetector::detect_lane(FrameHandle& frame)
+{
+    struct LaneWorkspace& work = workspaces[0];
+
+    prepare_frame(frame, work);
+    detect_frame(work);
+    output_frame(work);
+}
 
-            printf("  (%f, %f), (%f, %f)\n", x1, y1, x2, y2);
+/**
+ * Selects the pre-filter run ahead of Canny and its kernel size in pixels at
+ * LANE_REFERENCE_WIDTH. Returns false if the size is not valid for the kind.
+ */
+bool LaneDetector::set_prefilter(enum PreFilterKind kind, int size)
+{
+    return update_params([kind, size](struct LaneParams& params) { return params.set_prefilter(kind, size); });
+}
+
+/**
+ * Changes one tuning setting, named like its ~ parameter, from the next
+ * frame on. Returns false and changes nothing if the setting is invalid.
+ */
+bool LaneDetector::set_param(const string& name, const string& value)
+{
+    return update_params([&name, &value](struct LaneParams& params) { return params.set_option(name, value); });
+}
+
+void LaneDetector::param_listener(const diagnostic_msgs::KeyValueConstPtr& setting)
+{
+    // camera streams read their own tuning, which is fixed at startup
+    if (camera_streams)
+    {
+        printf("Ignored lane parameter %s: no hot reload in multi-camera mode\n", setting->key.c_str());
+        return;
+    }
+
+    if (set_param(setting->key, setting->value))
+    {
+        printf("Lane parameter %s set to %s\n", setting->key.c_str(), setting->value.c_str());
+    }
+    else
+    {
+        printf("Ignored invalid lane parameter %s %s\n", setting->key.c_str(), setting->value.c_str());
+    }
+}
+
+/**
+ * Takes the current tuning snapshot for the frame being prepared in work.
+ * The snapshot is recorded in the workspace's slot of params_in_use before
+ * it is used and taken again if it was replaced in between, so
+ * reclaim_params() can never free a snapshot a frame is using. Lock free:
+ * this runs for every frame.
+ */
+const struct LaneParams* LaneDetector::acquire_params(struct LaneWorkspace& work)
+{
+    atomic<const struct LaneParams*>& slot = params_in_use[&work - &workspaces[0]];
+    const struct LaneParams* snapshot = live_params.load();
+
+    for (;;)
+    {
+        slot.store(snapshot);
+
+        const struct LaneParams* latest = live_params.load();
+        if (latest == snapshot)
+        {
+            return snapshot;
         }
+
+        snapshot = latest;
+    }
+}
+
+/**
+ * Applies change to the configured tuning and publishes it at the current
+ * QoS level. Frames that were already prepared finish with the snapshot
+ * they started with. Returns false and publishes nothing if change fails.
+ */
+bool LaneDetector::update_params(const function<bool(struct LaneParams&)>& change)
+{
+    pthread_mutex_lock(&params_lock);
+
+    struct LaneParams next = base_params;
+    bool changed = change(next);
+
+    if (changed)
+    {
+        base_params = next;
+        publish_params();
+    }
+
+    pthread_mutex_unlock(&params_lock);
+    return changed;
+}
+
+/**
+ * Publishes base_params degraded to qos_level as the tuning new frames start
+ * with. Called with params_lock held.
+ */
+void LaneDetector::publish_params()
+{
+    struct LaneParams* next = new LaneParams(base_params);
+    qos_params(base_params, qos_level, *next);
+
+    // frames detected in parallel finish out of order and are never tracked
+    if (parallel_frames > 1)
+    {
+        next->track_lanes = false;
     }
 
+    retired_params.push_back(live_params.exchange(next));
+    reclaim_params();
+}
 
-    if (!lane_lines_left.empty() && !lane_lines_right.empty())
+/**
+ * Reports the processing time of a published frame, less the time it waited
+ * for the detector, to a QoS controller. Frames of engines without QoS
+ * support are left out, so the controller keeps its level for when the
+ * engine is switched back. Returns true if the controller changed level.
+ */
+bool LaneDetector::record_qos(QosController& controller, const struct LaneWorkspace& work, const string& camera)
+{
+    if (!qos_supported(*work.params))
     {
-        cv::Vec2d lane_left(lane_lines_left[0][0], lane_lines_left[0][1]);
-        cv::Vec2d lane_right(lane_lines_right[0][0], lane_lines_right[0][1]);
+        return false;
+    }
 
-        for (int index = 1; index < lane_lines_left.size(); index++)
+    double frame_ms = work.clock.total_ms() - work.clock.stage_ms[STAGE_WAIT];
+    if (!controller.record(frame_ms, work.params->qos_level))
+    {
+        return false;
+    }
+
+    int level = controller.get_level();
+    printf("%sQoS level %d (%s) after a %.1f ms frame, deadline %.1f ms\n", camera.c_str(), level,
+           QOS_LEVEL_NAMES[level], frame_ms, controller.get_deadline());
+    return true;
+}
+
+/**
+ * Frees the replaced snapshots no workspace holds any more. Called with
+ * params_lock held.
+ */
+void LaneDetector::reclaim_params()
+{
+    size_t kept = 0;
+
+    for (const struct LaneParams* snapshot : retired_params)
+    {
+        bool in_use = false;
+        for (const atomic<const struct LaneParams*>& slot : params_in_use)
         {
-            lane_left[0] += lane_lines_left[index][0];
-            lane_left[1] += lane_lines_left[index][1];
+            in_use = in_use || slot.load() == snapshot;
         }
-        
-        lane_left[0] /= (double)lane_lines_left.size();
-        lane_left[1] /= (double)lane_lines_left.size();
 
-        for (int index = 1; index < lane_lines_right.size(); index++)
+        if (in_use)
+        {
+            retired_params[kept++] = snapshot;
+        }
+        else
         {
-            lane_right[0] += lane_lines_right[index][0];
-            lane_right[1] += lane_lines_right[index][1];
+            delete snapshot;
         }
-        
-        lane_right[0] /= (double)lane_lines_right.size();
-        lane_right[1] /= (double)lane_lines_right.size();
-
-        int lane_start_y = edge_img.rows;
-        int lane_left_start_x = ((double)lane_start_y - lane_left[1]) / lane_left[0];
-        int lane_right_start_x = ((double)lane_start_y - lane_right[1]) / lane_right[0];
-        int lane_center = lane_left_start_x + ((double)lane_right_start_x - lane_left_start_x) / 2.0;
-        int xint = (lane_right[1] - lane_left[1]) / (lane_left[0] - lane_right[0]);
-        int yint = lane_right[0] * xint + lane_right[1];
-
-        cv::line(edge_img,
-                 cv::Point2i(xint, yint),
-                 cv::Point2i(lane_center, lane_start_y),
-                 cv::Scalar(255.0),
-                 5);
-
-        printf("\n  Distance from Center: %d px\n"
-               "  Right / Left X: %d, %d\n", edge_img.cols / 2 - lane_center, lane_right_start_x, lane_left_start_x);
-        
-        struct LanePose pose;
-        pose.center_offset = edge_img.cols / 2 - lane_center;
-        pose.heading = 0.0;
-        pose.confidence = detection_confidence(raw_lines_left, raw_lines_right);
-        current_pose = pose;
-
-        printf("  Detection Confidence: %%%3.1f\n", pose.confidence * 100.0);
     }
-    else
+
+    retired_params.resize(kept);
+}
+
+struct LanePose LaneDetector::get_vehicle_pose()
+{
+    return current_pose;
+}
+
+struct FramePoolStats LaneDetector::get_frame_stats()
+{
+    return frame_pool.get_stats();
+}
+
+/**
+ * Copies the counters of every pipeline stage. Returns false if the detector
+ * is not running in pipelined mode.
+ */
+bool LaneDetector::get_pipeline_stats(struct PipelineStageStats stats[NUM_PIPELINE_STAGES])
+{
+    for (int stage = 0; stage < NUM_PIPELINE_STAGES; stage++)
+    {
+        const struct PipelineCounters& counters = pipeline_counters[stage];
+        unsigned long frames = counters.frames;
+
+        stats[stage].frames = frames;
+        stats[stage].busy_ms = counters.busy_us / 1000.0;
+        stats[stage].stall_ms = counters.stall_us / 1000.0;
+        stats[stage].mean_depth = frames > 0 ? (double)counters.depth_sum / frames : 0.0;
+        stats[stage].max_depth = counters.max_depth;
+    }
+
+    return pipelined;
+}
+
+/**
+ * Summarizes the latency of every stage and of whole frames since startup
+ */
+void LaneDetector::get_latency(struct LatencySummary stages[NUM_LANE_STAGES], struct LatencySummary& frame)
+{
+    for (int stage = 0; stage < NUM_LANE_STAGES; stage++)
+    {
+        stages[stage] = stage_latency[stage].summarize();
+    }
+
+    frame = frame_latency.summarize();
+}
+
+static void add_latency_values(diagnostic_msgs::DiagnosticStatus& status, const char* name,
+                               const struct LatencySummary& summary)
+{
+    char value[32];
+    const char* labels[] = { "count", "mean_ms", "p50_ms", "p95_ms", "p99_ms", "max_ms" };
+    double values[] = { (double)summary.count, summary.mean_ms, summary.p50_ms, summary.p95_ms,
+                        summary.p99_ms, summary.max_ms };
+
+    for (int index = 0; index < 6; index++)
     {
-        struct LanePose pose;
-        pose.center_offset = 0;
-        pose.heading = 0.0;
-        pose.confidence = 0.0;
-        current_pose = pose;
+        diagnostic_msgs::KeyValue entry;
+        entry.key = string(name) + "/" + labels[index];
+        snprintf(value, sizeof(value), index == 0 ? "%.0f" : "%.3f", values[index]);
+        entry.value = value;
+        status.values.push_back(entry);
     }
+}
 
-    gettimeofday(&now, NULL);
-    unsigned long end_time = now.tv_sec * 1000 + now.tv_usec / 1000;
+/**
+ * Diagnostic status with the latency percentiles of every stage that has run
+ */
+static diagnostic_msgs::DiagnosticStatus latency_status(const string& name, const LatencyHistogram* stage_latency,
+                                                        const LatencyHistogram& frame_latency)
+{
+    struct LatencySummary frame = frame_latency.summarize();
+
+    diagnostic_msgs::DiagnosticStatus status;
+    status.level = diagnostic_msgs::DiagnosticStatus::OK;
+    status.name = name;
+    status.hardware_id = "lane_detection";
 
-    char filename[128];
-    memset(filename, '\0', 128);
+    char message[64];
+    snprintf(message, sizeof(message), "%lu frames, p99 %.1f ms", frame.count, frame.p99_ms);
+    status.message = message;
 
-    sprintf(filename, "/media/nvidia/seniorDesign/LaneDetectionDebug/%lu_img.jpg", end_time);
-    cv::imwrite(filename, img_color);
+    add_latency_values(status, "total", frame);
+    for (int stage = 0; stage < NUM_LANE_STAGES; stage++)
+    {
+        struct LatencySummary summary = stage_latency[stage].summarize();
+        if (summary.count > 0)
+        {
+            add_latency_values(status, LANE_STAGE_NAMES[stage], summary);
+        }
+    }
 
-    memset(filename, '\0', 32);
-    sprintf(filename, "/media/nvidia/seniorDesign/LaneDetectionDebug/%lu_edges.jpg", end_time);
-    cv::imwrite(filename, edge_img);
+    return status;
+}
 
-    printf("Processing took: %lu msec\n\n----\n\n", end_time - start_time);
+/**
+ * Publishes the latency percentiles of every stage that has run as one
+ * diagnostic status, or one per camera in multi-camera mode
+ */
+void LaneDetector::publish_latency()
+{
+    diagnostic_msgs::DiagnosticArray diagnostics;
+    diagnostics.header.stamp = ros::Time::now();
 
-    std_msgs::ColorRGBA mesg;
-    mesg.r = current_pose.center_offset / 850.0;
-    if (mesg.r > 1.0)
+    if (camera_streams)
     {
-        mesg.r = 1.0;
+        for (size_t camera = 0; camera < camera_streams->size(); camera++)
+        {
+            struct LaneStream& stream = (*camera_streams)[camera];
+            diagnostics.status.push_back(latency_status("lane_detection: " + stream.name + " stage latency",
+                                                        stream.stage_latency, stream.frame_latency));
+        }
     }
-    else if (mesg.r < -1.0)
+    else
     {
-        mesg.r = -1.0;
+        diagnostics.status.push_back(latency_status("lane_detection: stage latency", stage_latency, frame_latency));
     }
-    mesg.g = current_pose.confidence;
-    pose_publisher.publish(mesg);
 
-    delete source_img;
+    diagnostics_publisher.publish(diagnostics);
 }
 
-bool LaneDetector::set_median_blur_radius(int radius)
+/**
+ * Copies the debug writer counters. Returns false if no frames are sampled.
+ */
+bool LaneDetector::get_debug_stats(struct DebugWriterStats& stats)
 {
-    if (radius % 2 == 1)
+    if (!debug_writer)
     {
-        median_blur_radius = radius;
-        return true;
+        return false;
     }
 
-    return false;
+    stats = debug_writer->get_stats();
+    return true;
 }
 
-void LaneDetector::set_hough_theta_inc(double degrees)
+/**
+ * Copies the frame and latency counters of every camera. Returns false if
+ * the detector is not running in multi-camera mode.
+ */
+bool LaneDetector::get_camera_stats(vector<struct LaneStreamStats>& stats)
 {
-    hough_theta_inc = degrees * CV_PI / 180.0;
+    if (!camera_streams)
+    {
+        stats.clear();
+        return false;
+    }
+
+    camera_streams->get_stats(stats);
+    return true;
 }
 
-struct LanePose LaneDetector::get_vehicle_pose()
+/**
+ * Copies the recorder counters. Returns false if frames are not recorded.
+ */
+bool LaneDetector::get_recording_stats(struct RecordingStats& stats)
 {
-    return current_pose;
+    if (!recorder)
+    {
+        return false;
+    }
+
+    stats = recorder->get_stats();
+    return true;
+}
+
+/**
+ * Copies the QoS counters, summed over the cameras in multi-camera mode.
+ * Returns false if there is no frame deadline.
+ */
+bool LaneDetector::get_qos_stats(struct QosStats& stats)
+{
+    if (!qos)
+    {
+        return false;
+    }
+
+    if (camera_qos.empty())
+    {
+        stats = qos->get_stats();
+        return true;
+    }
+
+    stats = camera_qos[0]->get_stats();
+    for (size_t camera = 1; camera < camera_qos.size(); camera++)
+    {
+        struct QosStats more = camera_qos[camera]->get_stats();
+        stats.frames += more.frames;
+        stats.missed += more.missed;
+        stats.changes += more.changes;
+        for (int level = 0; level < QOS_LEVELS; level++)
+        {
+            stats.level_frames[level] += more.level_frames[level];
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Copies the frame-parallel counters. Returns false if the detector is not
+ * running in frame-parallel mode.
+ */
+bool LaneDetector::get_reorder_stats(struct ReorderStats& stats)
+{
+    pthread_mutex_lock(&reorder_lock);
+    stats = reorder_stats;
+    pthread_mutex_unlock(&reorder_lock);
+
+    return parallel_frames > 1;
 }
 
 void LaneDetector::lane_guidance()
@@ -375,8 +1445,17 @@ void LaneDetector::lane_guidance()
     stdin_timeout[0].fd = STDIN_FILENO;
     stdin_timeout[0].events = POLLIN | POLLPRI;
 
+    chrono::steady_clock::time_point last_publish = chrono::steady_clock::now();
+
     while (ros::ok())
     {
+        if (latency_publish_period > 0.0 &&
+            chrono::duration<double>(chrono::steady_clock::now() - last_publish).count() >= latency_publish_period)
+        {
+            publish_latency();
+            last_publish = chrono::steady_clock::now();
+        }
+
         int poll_status = poll(stdin_timeout, 1, 10);
 
         if (poll_status > 0)
@@ -0,0 +1,273 @@
+#include "LaneEvaluation.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+
+/**
+ * Reads ground truth for frames in load order. Each line holds a frame index
+ * followed by either the true center offset in reference width pixels or
+ * "none" for frames without a lane. Blank lines and lines starting with #
+ * are skipped. Returns false if the file cannot be read or a line is
+ * malformed.
+ */
+bool load_lane_labels(const string& path, size_t num_frames, vector<struct LaneLabel>& labels)
+{
+    FILE* file = fopen(path.c_str(), "r");
+    if (!file)
+    {
+        printf("%s: failed to open labels\n", path.c_str());
+        return false;
+    }
+
+    struct LaneLabel unlabeled = { false, false, 0.0 };
+    labels.assign(num_frames, unlabeled);
+
+    char line[256];
+    int line_number = 0;
+    bool valid = true;
+
+    while (valid && fgets(line, sizeof(line), file))
+    {
+        line_number++;
+
+        char value[64];
+        unsigned long index = 0;
+        int fields = sscanf(line, "%lu %63s", &index, value);
+        if (fields <= 0 || line[strspn(line, " \t")] == '#')
+        {
+            continue;
+        }
+
+        char* end = NULL;
+        double offset = fields == 2 ? strtod(value, &end) : 0.0;
+        bool empty = fields == 2 && strcmp(value, "none") == 0;
+
+        if (fields != 2 || (!empty && *end != '\0'))
+        {
+            printf("%s:%d: expected <frame> <offset px | none>\n", path.c_str(), line_number);
+            valid = false;
+        }
+        else if (index >= num_frames)
+        {
+            printf("%s:%d: frame %lu is past the last of %lu frames\n", path.c_str(), line_number, index,
+                   num_frames);
+            valid = false;
+        }
+        else
+        {
+            labels[index].labeled = true;
+            labels[index].lane = !empty;
+            labels[index].center_offset = empty ? 0.0 : offset;
+        }
+    }
+
+    fclose(file);
+    return valid;
+}
+
+/**
+ * Runs the core over every frame and scores it against the labels. A first
+ * pass warms up buffers and is thrown away, then the tracker is reset so the
+ * scored pass starts cold, just like the node does on a new drive.
+ */
+struct LaneEvaluation evaluate_lanes(LaneCore& core, struct LaneFilters& filters, const vector<cv::Mat>& frames,
+                                     const vector<struct LaneLabel>& labels)
+{
+    struct LaneEvaluation evaluation;
+    memset(&evaluation, 0, sizeof(evaluation));
+
+    struct LaneWorkspace work;
+    work.filters = &filters;
+    LatencyHistogram latency;
+    vector<double> offset_errors;
+
+    for (int pass = 0; pass < 2; pass++)
+    {
+        core.reset();
+
+        for (size_t index = 0; index < frames.size(); index++)
+        {
+            work.sequence = index + 1;
+            core.prepare(frames[index], work);
+            core.detect(work);
+
+            if (pass == 0)
+            {
+                continue;
+            }
+
+            latency.record(work.clock.total_ms());
+            evaluation.frames++;
+
+            if (index >= labels.size() || !labels[index].labeled)
+            {
+                continue;
+            }
+
+            bool found = work.pose.confidence >= EVAL_MIN_CONFIDENCE;
+            if (!labels[index].lane)
+            {
+                evaluation.empty_frames++;
+                evaluation.false_detections += found ? 1 : 0;
+                continue;
+            }
+
+            evaluation.lane_frames++;
+            if (found)
+            {
+                evaluation.detected++;
+                offset_errors.push_back(fabs(work.pose.center_offset - labels[index].center_offset));
+            }
+        }
+    }
+
+    evaluation.detection_rate = evaluation.lane_frames > 0 ?
+                                (double)evaluation.detected / evaluation.lane_frames : 0.0;
+    evaluation.false_rate = evaluation.empty_frames > 0 ?
+                            (double)evaluation.false_detections / evaluation.empty_frames : 0.0;
+
+    if (!offset_errors.empty())
+    {
+        sort(offset_errors.begin(), offset_errors.end());
+        for (double error : offset_errors)
+        {
+            evaluation.mean_offset_error += error;
+        }
+
+        evaluation.mean_offset_error /= (double)offset_errors.size();
+        evaluation.p95_offset_error = offset_errors[min(offset_errors.size() - 1,
+                                                        (size_t)(0.95 * offset_errors.size()))];
+    }
+
+    evaluation.latency = latency.summarize();
+    return evaluation;
+}
+
+/**
+ * Reads a baseline written by save_lane_baseline(), possibly edited by hand.
+ * Lines are "<key> <value>", # starts a comment. Tolerances missing from the
+ * file keep their defaults.
+ */
+bool load_lane_baseline(const string& path, struct LaneBaseline& baseline)
+{
+    FILE* file = fopen(path.c_str(), "r");
+    if (!file)
+    {
+        return false;
+    }
+
+    struct KeyField
+    {
+        const char* key;
+        double* field;
+    };
+
+    baseline.detection_rate = 0.0;
+    baseline.false_rate = 1.0;
+    baseline.mean_offset_error = 0.0;
+    baseline.p95_latency_ms = 0.0;
+    baseline.detection_tolerance = 0.02;
+    baseline.offset_tolerance = 2.0;
+    baseline.latency_budget = 1.10;
+
+    struct KeyField fields[] = {
+        { "detection_rate", &baseline.detection_rate },
+        { "false_rate", &baseline.false_rate },
+        { "mean_offset_error_px", &baseline.mean_offset_error },
+        { "p95_latency_ms", &baseline.p95_latency_ms },
+        { "detection_tolerance", &baseline.detection_tolerance },
+        { "offset_tolerance_px", &baseline.offset_tolerance },
+        { "latency_budget", &baseline.latency_budget },
+    };
+
+    char line[256];
+    while (fgets(line, sizeof(line), file))
+    {
+        char key[64];
+        double value = 0.0;
+        if (line[strspn(line, " \t")] == '#' || sscanf(line, "%63s %lf", key, &value) != 2)
+        {
+            continue;
+        }
+
+        for (const struct KeyField& field : fields)
+        {
+            if (strcmp(key, field.key) == 0)
+            {
+                *field.field = value;
+            }
+        }
+    }
+
+    fclose(file);
+    return true;
+}
+
+/**
+ * Writes the results of a run as the baseline later runs are checked
+ * against, with the default tolerances
+ */
+bool save_lane_baseline(const string& path, const struct LaneEvaluation& evaluation)
+{
+    FILE* file = fopen(path.c_str(), "w");
+    if (!file)
+    {
+        printf("%s: failed to write baseline\n", path.c_str());
+        return false;
+    }
+
+    fprintf(file, "# lane_bench regression baseline. rerun with --update to replace it\n");
+    fprintf(file, "detection_rate %.4f\n", evaluation.detection_rate);
+    fprintf(file, "false_rate %.4f\n", evaluation.false_rate);
+    fprintf(file, "mean_offset_error_px %.2f\n", evaluation.mean_offset_error);
+    fprintf(file, "p95_latency_ms %.3f\n", evaluation.latency.p95_ms);
+    fprintf(file, "\n# allowed regressions\n");
+    fprintf(file, "detection_tolerance 0.02\n");
+    fprintf(file, "offset_tolerance_px 2.0\n");
+    fprintf(file, "latency_budget 1.10\n");
+
+    fclose(file);
+    return true;
+}
+
+/**
+ * Prints every limit the evaluation breaks. Returns true if it breaks none.
+ */
+bool check_lane_baseline(const struct LaneEvaluation& evaluation, const struct LaneBaseline& baseline)
+{
+    bool passed = true;
+
+    if (evaluation.detection_rate < baseline.detection_rate - baseline.detection_tolerance)
+    {
+        printf("FAIL detection rate %.4f is below baseline %.4f - %.4f\n", evaluation.detection_rate,
+               baseline.detection_rate, baseline.detection_tolerance);
+        passed = false;
+    }
+
+    if (evaluation.false_rate > baseline.false_rate + baseline.detection_tolerance)
+    {
+        printf("FAIL false detection rate %.4f is above baseline %.4f + %.4f\n", evaluation.false_rate,
+               baseline.false_rate, baseline.detection_tolerance);
+        passed = false;
+    }
+
+    if (evaluation.mean_offset_error > baseline.mean_offset_error + baseline.offset_tolerance)
+    {
+        printf("FAIL mean offset error %.2f px is above baseline %.2f + %.2f px\n", evaluation.mean_offset_error,
+               baseline.mean_offset_error, baseline.offset_tolerance);
+        passed = false;
+    }
+
+    if (evaluation.latency.p95_ms > baseline.p95_latency_ms * baseline.latency_budget)
+    {
+        printf("FAIL p95 latency %.3f ms is above baseline %.3f ms x %.2f\n", evaluation.latency.p95_ms,
+               baseline.p95_latency_ms, baseline.latency_budget);
+        passed = false;
+    }
+
+    return passed;
+}
@@ -0,0 +1,181 @@
+#include "LaneStreams.h"
+#include <stdexcept>
+#include <time.h>
+
+using namespace std;
+
+LaneStream::LaneStream(const string& name, int index, WorkerPool* pool) : name(name), index(index), core(pool),
+        last_sequence(0), scheduled(false), detected(0)
+{
+    work.filters = &filters;
+    work.done = false;
+}
+
+LaneStreams::LaneStreams(WorkerPool& pool, const LaneStreamOutput& output) : pool(pool), output(output),
+        running(true), jobs(0), max_frame_age_ms(200)
+{
+    // jobs are only ever run by the workers
+    if (pool.size() == 0)
+    {
+        throw runtime_error("LaneStreams: the worker pool has no threads to detect on");
+    }
+
+    if (pthread_mutex_init(&jobs_lock, NULL) != 0 || pthread_cond_init(&jobs_done, NULL) != 0)
+    {
+        throw runtime_error("LaneStreams: failed to initialize the job counter");
+    }
+}
+
+LaneStreams::~LaneStreams()
+{
+    stop();
+
+    for (struct LaneStream* stream : streams)
+    {
+        delete stream;
+    }
+
+    pthread_cond_destroy(&jobs_done);
+    pthread_mutex_destroy(&jobs_lock);
+}
+
+/**
+ * Adds a camera. Streams must all be added, and their cores and filters set
+ * up, before the first frame is committed.
+ */
+struct LaneStream& LaneStreams::add_stream(const string& name)
+{
+    streams.push_back(new LaneStream(name, (int)streams.size(), &pool));
+    return *streams.back();
+}
+
+size_t LaneStreams::size() const
+{
+    return streams.size();
+}
+
+struct LaneStream& LaneStreams::operator[](size_t index)
+{
+    return *streams[index];
+}
+
+/**
+ * Publishes a slot filled from stream.frames.begin_write() as the stream's
+ * newest frame and makes sure a job will detect it
+ */
+void LaneStreams::commit_frame(struct LaneStream& stream, FrameSlot* slot)
+{
+    stream.frames.commit_write(slot);
+    schedule(stream);
+}
+
+/**
+ * Queues a job for the stream unless one is already queued or running. A
+ * running job checks for newer frames after it lets go of scheduled, so a
+ * frame committed while it runs is never left without a job.
+ */
+void LaneStreams::schedule(struct LaneStream& stream)
+{
+    if (stream.scheduled.exchange(true))
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&jobs_lock);
+    if (!running)
+    {
+        pthread_mutex_unlock(&jobs_lock);
+        stream.scheduled = false;
+        return;
+    }
+    jobs++;
+    pthread_mutex_unlock(&jobs_lock);
+
+    pool.submit([this, &stream]()
+    {
+        run(stream);
+    });
+}
+
+/**
+ * Job of one stream: detects its newest frame, hands the result to the
+ * output callback and reschedules the stream if another frame arrived
+ */
+void LaneStreams::run(struct LaneStream& stream)
+{
+    FrameHandle frame = stream.frames.take_newer(stream.last_sequence, max_frame_age_ms);
+
+    if (frame)
+    {
+        struct LaneWorkspace& work = stream.work;
+
+        // frames are stamped on CLOCK_MONOTONIC when committed
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        double wait_ms = (now.tv_sec - frame->received.tv_sec) * 1000.0 +
+                         (now.tv_nsec - frame->received.tv_nsec) / 1000000.0;
+
+        work.sequence = frame->sequence;
+        work.stamp_ns = frame->stamp_ns;
+        stream.core.prepare(frame->image, work);
+        work.clock.add(STAGE_WAIT, wait_ms);
+        frame.release();
+
+        stream.core.detect(work);
+        output(stream);
+
+        for (int stage = 0; stage < NUM_LANE_STAGES; stage++)
+        {
+            if (work.clock.stage_ms[stage] > 0.0)
+            {
+                stream.stage_latency[stage].record(work.clock.stage_ms[stage]);
+            }
+        }
+        stream.frame_latency.record(work.clock.total_ms());
+        stream.detected++;
+    }
+
+    // once scheduled is clear the next job may start, so the stream's state
+    // is not touched past this point
+    unsigned long taken = stream.last_sequence;
+    stream.scheduled = false;
+    if (stream.frames.has_newer(taken))
+    {
+        schedule(stream);
+    }
+
+    pthread_mutex_lock(&jobs_lock);
+    if (--jobs == 0)
+    {
+        pthread_cond_broadcast(&jobs_done);
+    }
+    pthread_mutex_unlock(&jobs_lock);
+}
+
+/**
+ * Stops scheduling jobs and waits for the queued and running ones to finish.
+ * Frames committed afterwards are kept but never detected.
+ */
+void LaneStreams::stop()
+{
+    pthread_mutex_lock(&jobs_lock);
+    running = false;
+    while (jobs > 0)
+    {
+        pthread_cond_wait(&jobs_done, &jobs_lock);
+    }
+    pthread_mutex_unlock(&jobs_lock);
+}
+
+void LaneStreams::get_stats(vector<struct LaneStreamStats>& stats)
+{
+    stats.resize(streams.size());
+
+    for (size_t index = 0; index < streams.size(); index++)
+    {
+        stats[index].name = streams[index]->name;
+        stats[index].frames = streams[index]->frames.get_stats();
+        stats[index].detected = streams[index]->detected;
+        stats[index].latency = streams[index]->frame_latency.summarize();
+    }
+}
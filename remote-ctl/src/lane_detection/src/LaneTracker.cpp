@@ -0,0 +1,121 @@
+#include "LaneTracker.h"
+
+using namespace std;
+
+// expected change per frame and measurement noise as standard deviations
+const double PROCESS_RADIUS_SD = 2.0;
+const double PROCESS_THETA_SD = 0.5 * CV_PI / 180.0;
+const double MEASURE_RADIUS_SD = 4.0;
+const double MEASURE_THETA_SD = 1.0 * CV_PI / 180.0;
+
+LaneTracker::LaneTracker() : hits(0)
+{
+    for (cv::KalmanFilter& filter : filters)
+    {
+        // state is (radius, theta, radius change, theta change), the
+        // measurement is (radius, theta)
+        filter.init(4, 2, 0, CV_64F);
+        cv::setIdentity(filter.transitionMatrix);
+        filter.transitionMatrix.at<double>(0, 2) = 1.0;
+        filter.transitionMatrix.at<double>(1, 3) = 1.0;
+        cv::setIdentity(filter.measurementMatrix);
+
+        cv::setIdentity(filter.processNoiseCov);
+        filter.processNoiseCov.at<double>(0, 0) = PROCESS_RADIUS_SD * PROCESS_RADIUS_SD;
+        filter.processNoiseCov.at<double>(1, 1) = PROCESS_THETA_SD * PROCESS_THETA_SD;
+        filter.processNoiseCov.at<double>(2, 2) = PROCESS_RADIUS_SD * PROCESS_RADIUS_SD;
+        filter.processNoiseCov.at<double>(3, 3) = PROCESS_THETA_SD * PROCESS_THETA_SD;
+
+        cv::setIdentity(filter.measurementNoiseCov);
+        filter.measurementNoiseCov.at<double>(0, 0) = MEASURE_RADIUS_SD * MEASURE_RADIUS_SD;
+        filter.measurementNoiseCov.at<double>(1, 1) = MEASURE_THETA_SD * MEASURE_THETA_SD;
+    }
+}
+
+/**
+ * Forgets the tracked lines. The next correct() starts tracking afresh.
+ */
+void LaneTracker::reset()
+{
+    hits = 0;
+}
+
+/**
+ * Advances both lines by one frame and returns where they are expected in
+ * an image of the given size. Has to be called once per frame while lines
+ * are tracked, before correct(). Returns true only if the tracker is locked;
+ * a size change drops the track.
+ */
+bool LaneTracker::predict(const cv::Size& new_size, cv::Vec2d predicted[NUM_LANE_SIDES])
+{
+    if (hits == 0 || new_size != size)
+    {
+        hits = 0;
+        return false;
+    }
+
+    for (int side = 0; side < NUM_LANE_SIDES; side++)
+    {
+        const cv::Mat& state = filters[side].predict();
+        predicted[side] = cv::Vec2d(state.at<double>(0), state.at<double>(1));
+    }
+
+    return locked();
+}
+
+/**
+ * Feeds a confident detection of both lines to the filters, starting a
+ * new track if none is running
+ */
+void LaneTracker::correct(const cv::Size& new_size, const cv::Vec2d measured[NUM_LANE_SIDES])
+{
+    if (hits == 0 || new_size != size)
+    {
+        for (int side = 0; side < NUM_LANE_SIDES; side++)
+        {
+            cv::KalmanFilter& filter = filters[side];
+            filter.statePost = cv::Mat::zeros(4, 1, CV_64F);
+            filter.statePost.at<double>(0) = measured[side][0];
+            filter.statePost.at<double>(1) = measured[side][1];
+
+            // nothing is known about the rates yet
+            cv::setIdentity(filter.errorCovPost);
+            filter.errorCovPost.at<double>(0, 0) = MEASURE_RADIUS_SD * MEASURE_RADIUS_SD;
+            filter.errorCovPost.at<double>(1, 1) = MEASURE_THETA_SD * MEASURE_THETA_SD;
+            filter.errorCovPost.at<double>(2, 2) = MEASURE_RADIUS_SD * MEASURE_RADIUS_SD;
+            filter.errorCovPost.at<double>(3, 3) = MEASURE_THETA_SD * MEASURE_THETA_SD;
+        }
+
+        size = new_size;
+        hits = 1;
+        return;
+    }
+
+    cv::Mat measurement(2, 1, CV_64F);
+
+    for (int side = 0; side < NUM_LANE_SIDES; side++)
+    {
+        measurement.at<double>(0) = measured[side][0];
+        measurement.at<double>(1) = measured[side][1];
+        filters[side].correct(measurement);
+    }
+
+    hits++;
+}
+
+/**
+ * Locked once enough consecutive frames agreed with the predictions
+ */
+bool LaneTracker::locked() const
+{
+    return hits >= TRACK_LOCK_FRAMES;
+}
+
+/**
+ * Filtered (radius, theta) of one line after the latest correction
+ */
+cv::Vec2d LaneTracker::get_line(enum LaneSide side) const
+{
+    const cv::Mat& state = filters[side].statePost;
+    return cv::Vec2d(state.at<double>(0), state.at<double>(1));
+}
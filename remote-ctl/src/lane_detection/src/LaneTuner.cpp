@@ -0,0 +1,282 @@
+#include "LaneTuner.h"
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <map>
+#include <algorithm>
+#include "LaneCore.h"
+
+using namespace std;
+
+/// Settings that change what the pre-filter is given, so runs that differ in
+/// them cannot share pre-filtered frames
+static const char* PREFILTER_SETTINGS[] = { "prefilter", "prefilter_size", "working_width" };
+
+/**
+ * Reads the settings to sweep. Lines are "<name> <value> [value ...]" using
+ * the LaneParams::set_option() names, # starts a comment. Every value is
+ * parsed and range checked by set_option() up front, so a typo or a value
+ * the detector cannot run with does not surface halfway through a long
+ * sweep. A prefilter_size that is even is only rejected in combinations
+ * with a kind that needs odd sizes, and those runs keep the default of
+ * whichever of the two settings is applied second.
+ */
+bool load_lane_sweep(const string& path, vector<struct SweepParameter>& sweep)
+{
+    FILE* file = fopen(path.c_str(), "r");
+    if (!file)
+    {
+        printf("%s: failed to open sweep\n", path.c_str());
+        return false;
+    }
+
+    struct LaneParams probe;
+    char line[1024];
+    bool valid = true;
+    sweep.clear();
+
+    while (valid && fgets(line, sizeof(line), file))
+    {
+        if (line[strspn(line, " \t")] == '#')
+        {
+            continue;
+        }
+
+        struct SweepParameter parameter;
+        for (char* token = strtok(line, " \t\r\n"); token; token = strtok(NULL, " \t\r\n"))
+        {
+            if (parameter.name.empty())
+            {
+                parameter.name = token;
+            }
+            else if (probe.set_option(parameter.name, token))
+            {
+                parameter.values.push_back(token);
+            }
+            else
+            {
+                printf("%s: invalid setting %s %s\n", path.c_str(), parameter.name.c_str(), token);
+                valid = false;
+                break;
+            }
+        }
+
+        if (valid && !parameter.values.empty())
+        {
+            sweep.push_back(parameter);
+        }
+    }
+
+    fclose(file);
+
+    if (valid && sweep.empty())
+    {
+        printf("%s: nothing to sweep\n", path.c_str());
+    }
+
+    return valid && !sweep.empty();
+}
+
+/**
+ * Runs every combination of the swept values over the frames, spread over
+ * threads threads of the pool, and scores each against the labels. Runs are
+ * grouped by their pre-filter settings: the first run of each group fills a
+ * cache of pre-filtered frames that the rest of the group reads. Every run
+ * votes on one thread, so its latency is comparable with the others but not
+ * with the node's.
+ */
+void tune_lanes(const vector<struct SweepParameter>& sweep, const vector<cv::Mat>& frames,
+                const vector<struct LaneLabel>& labels, WorkerPool& pool, int threads,
+                vector<struct TuneResult>& results)
+{
+    size_t combinations = 1;
+    for (const struct SweepParameter& parameter : sweep)
+    {
+        combinations *= parameter.values.size();
+    }
+
+    results.assign(combinations, TuneResult());
+    vector<int> group_of(combinations);
+    map<string, int> groups;
+    vector<size_t> filling_runs;
+    vector<size_t> reading_runs;
+
+    for (size_t index = 0; index < combinations; index++)
+    {
+        // mixed radix: the first parameter changes fastest
+        size_t rest = index;
+        string group;
+
+        for (const struct SweepParameter& parameter : sweep)
+        {
+            const string& value = parameter.values[rest % parameter.values.size()];
+            rest /= parameter.values.size();
+            results[index].settings.push_back(make_pair(parameter.name, value));
+
+            for (const char* setting : PREFILTER_SETTINGS)
+            {
+                if (parameter.name == setting)
+                {
+                    group += parameter.name + "=" + value + " ";
+                }
+            }
+        }
+
+        map<string, int>::iterator found = groups.find(group);
+        if (found == groups.end())
+        {
+            found = groups.insert(make_pair(group, (int)groups.size())).first;
+            filling_runs.push_back(index);
+        }
+        else
+        {
+            reading_runs.push_back(index);
+        }
+
+        group_of[index] = found->second;
+    }
+
+    vector<struct PrefilterCache> caches(groups.size());
+    for (struct PrefilterCache& cache : caches)
+    {
+        cache.frames.assign(frames.size(), PrefilteredFrame());
+        cache.filling = true;
+    }
+
+    printf("Sweeping %lu combinations in %lu pre-filter groups on %d threads\n",
+           combinations, groups.size(), threads);
+
+    atomic<size_t> finished(0);
+    auto run = [&](size_t index)
+    {
+        LaneCore core;
+        core.verbose = false;
+        core.params.hough_threads = 1;
+        core.prefilter_cache = &caches[group_of[index]];
+
+        for (const pair<string, string>& setting : results[index].settings)
+        {
+            core.params.set_option(setting.first, setting.second);
+        }
+
+        struct LaneFilters filters;
+        struct TuneResult& result = results[index];
+        result.evaluation = evaluate_lanes(core, filters, frames, labels);
+
+        unsigned long labeled = result.evaluation.lane_frames + result.evaluation.empty_frames;
+        unsigned long correct = result.evaluation.detected + result.evaluation.empty_frames -
+                                result.evaluation.false_detections;
+        result.accuracy = labeled > 0 ? (double)correct / labeled : 0.0;
+        result.pareto = false;
+
+        size_t done = ++finished;
+        if (done % 50 == 0 || done == combinations)
+        {
+            printf("  %lu / %lu\n", done, combinations);
+        }
+    };
+
+    // the filling runs go first, so every cache is complete and read only
+    // before the runs sharing it start
+    for (const vector<size_t>* runs : { &filling_runs, &reading_runs })
+    {
+        atomic<size_t> next(0);
+        pool.parallel_for(threads, [&](int)
+        {
+            for (size_t taken = next++; taken < runs->size(); taken = next++)
+            {
+                run((*runs)[taken]);
+            }
+        });
+
+        for (struct PrefilterCache& cache : caches)
+        {
+            cache.filling = false;
+        }
+    }
+}
+
+/**
+ * Whether a is more accurate than b. Equal accuracy goes to the smaller
+ * offset error.
+ */
+static bool more_accurate(const struct TuneResult& a, const struct TuneResult& b)
+{
+    return a.accuracy > b.accuracy ||
+           (a.accuracy == b.accuracy && a.evaluation.mean_offset_error < b.evaluation.mean_offset_error);
+}
+
+/**
+ * Marks the results no other result beats on both accuracy and mean frame
+ * latency, and lists them most accurate first
+ */
+void pareto_front(vector<struct TuneResult>& results, vector<const struct TuneResult*>& front)
+{
+    front.clear();
+
+    for (struct TuneResult& result : results)
+    {
+        result.pareto = true;
+
+        for (const struct TuneResult& other : results)
+        {
+            double latency = result.evaluation.latency.mean_ms;
+            double other_latency = other.evaluation.latency.mean_ms;
+
+            if (!more_accurate(result, other) && other_latency <= latency &&
+                (more_accurate(other, result) || other_latency < latency))
+            {
+                result.pareto = false;
+                break;
+            }
+        }
+
+        if (result.pareto)
+        {
+            front.push_back(&result);
+        }
+    }
+
+    sort(front.begin(), front.end(), [](const struct TuneResult* a, const struct TuneResult* b)
+    {
+        return more_accurate(*a, *b);
+    });
+}
+
+/**
+ * Writes the front as a config the node loads with ~tuned_config, picking
+ * one point with ~tuned_point. Only swept settings are written; everything
+ * else keeps the node's defaults.
+ */
+bool save_lane_config(const string& path, const vector<const struct TuneResult*>& front)
+{
+    FILE* file = fopen(path.c_str(), "w");
+    if (!file)
+    {
+        printf("%s: failed to write lane config\n", path.c_str());
+        return false;
+    }
+
+    fprintf(file, "# lane_bench tune: Pareto front of accuracy against mean frame latency,\n");
+    fprintf(file, "# most accurate first. Load with ~tuned_config and pick a point with ~tuned_point\n");
+
+    for (size_t point = 0; point < front.size(); point++)
+    {
+        const struct TuneResult& result = *front[point];
+
+        fprintf(file, "\npoint %lu\n", point);
+        fprintf(file, "# accuracy %.4f   detection rate %.4f   false rate %.4f   offset error %.2f px\n",
+                result.accuracy, result.evaluation.detection_rate, result.evaluation.false_rate,
+                result.evaluation.mean_offset_error);
+        fprintf(file, "# latency mean %.3f ms   p95 %.3f ms\n", result.evaluation.latency.mean_ms,
+                result.evaluation.latency.p95_ms);
+
+        for (const pair<string, string>& setting : result.settings)
+        {
+            fprintf(file, "%s %s\n", setting.first.c_str(), setting.second.c_str());
+        }
+    }
+
+    fclose(file);
+    return true;
+}
@@ -0,0 +1,132 @@
+#include "LatencyHistogram.h"
+#include <algorithm>
+
+using namespace std;
+
+LatencyHistogram::LatencyHistogram()
+{
+    reset();
+}
+
+/**
+ * Bucket of a value. The top LATENCY_SUB_BITS + 1 bits of the value pick the
+ * bucket within its power of two.
+ */
+int LatencyHistogram::bucket_index(unsigned long value_us)
+{
+    const unsigned long sub_buckets = 1UL << LATENCY_SUB_BITS;
+
+    if (value_us < sub_buckets)
+    {
+        return (int)value_us;
+    }
+
+    int exponent = 63 - __builtin_clzl(value_us);
+    if (exponent > LATENCY_MAX_EXPONENT)
+    {
+        return LATENCY_BUCKETS - 1;
+    }
+
+    int shift = exponent - LATENCY_SUB_BITS;
+    return (int)(((unsigned long)(shift + 1) << LATENCY_SUB_BITS) + ((value_us >> shift) - sub_buckets));
+}
+
+unsigned long LatencyHistogram::bucket_lower(int index)
+{
+    const int sub_buckets = 1 << LATENCY_SUB_BITS;
+
+    if (index < sub_buckets)
+    {
+        return (unsigned long)index;
+    }
+
+    int shift = (index >> LATENCY_SUB_BITS) - 1;
+    return (unsigned long)(sub_buckets + (index & (sub_buckets - 1))) << shift;
+}
+
+/**
+ * Largest value in a bucket. The last bucket also takes every value too large
+ * for the histogram and has no upper edge.
+ */
+unsigned long LatencyHistogram::bucket_upper(int index)
+{
+    return index + 1 < LATENCY_BUCKETS ? bucket_lower(index + 1) - 1 : ~0UL;
+}
+
+/**
+ * Adds one duration. Negative durations count as zero
+ */
+void LatencyHistogram::record(double ms)
+{
+    unsigned long value_us = ms > 0.0 ? (unsigned long)(ms * 1000.0 + 0.5) : 0;
+
+    buckets[bucket_index(value_us)].fetch_add(1, memory_order_relaxed);
+    count.fetch_add(1, memory_order_relaxed);
+    sum_us.fetch_add(value_us, memory_order_relaxed);
+
+    unsigned long previous = max_us.load(memory_order_relaxed);
+    while (value_us > previous && !max_us.compare_exchange_weak(previous, value_us, memory_order_relaxed))
+    {
+    }
+}
+
+/**
+ * Clears every bucket. Values recorded at the same time may be lost
+ */
+void LatencyHistogram::reset()
+{
+    for (int index = 0; index < LATENCY_BUCKETS; index++)
+    {
+        buckets[index].store(0, memory_order_relaxed);
+    }
+
+    count.store(0, memory_order_relaxed);
+    sum_us.store(0, memory_order_relaxed);
+    max_us.store(0, memory_order_relaxed);
+}
+
+/**
+ * Percentiles of everything recorded so far. A percentile is reported as the
+ * upper edge of its bucket, capped at the maximum, so it never understates
+ * latency. Taken while other threads record, the result is a close but not
+ * exact snapshot.
+ */
+struct LatencySummary LatencyHistogram::summarize() const
+{
+    struct LatencySummary summary = { 0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+    unsigned long counts[LATENCY_BUCKETS];
+    unsigned long total = 0;
+
+    for (int index = 0; index < LATENCY_BUCKETS; index++)
+    {
+        counts[index] = buckets[index].load(memory_order_relaxed);
+        total += counts[index];
+    }
+
+    if (total == 0)
+    {
+        return summary;
+    }
+
+    unsigned long max_value = max_us.load(memory_order_relaxed);
+    summary.count = total;
+    summary.mean_ms = (double)sum_us.load(memory_order_relaxed) / 1000.0 / (double)max(total, count.load(memory_order_relaxed));
+    summary.max_ms = max_value / 1000.0;
+
+    const double fractions[] = { 0.50, 0.95, 0.99 };
+    double* results[] = { &summary.p50_ms, &summary.p95_ms, &summary.p99_ms };
+    unsigned long seen = 0;
+    int percentile = 0;
+
+    for (int index = 0; index < LATENCY_BUCKETS && percentile < 3; index++)
+    {
+        seen += counts[index];
+        while (percentile < 3 && (double)seen >= fractions[percentile] * (double)total)
+        {
+            *results[percentile] = min(bucket_upper(index), max_value) / 1000.0;
+            percentile++;
+        }
+    }
+
+    return summary;
+}
@@ -0,0 +1,169 @@
+#include "PreFilter.h"
+#include <cmath>
+#include <algorithm>
+#include "opencv2/imgproc.hpp"
+
+using namespace std;
+
+const char* PREFILTER_NAMES[NUM_PREFILTER_KINDS] = {
+    "color_median", "median", "box", "gaussian", "bilateral"
+};
+
+PreFilter::PreFilter() : kind(PREFILTER_DEFAULT_KIND), size(PREFILTER_DEFAULT_SIZE)
+{
+    // range weights are spaced so neighbouring levels overlap at one sigma
+    double spacing = 255.0 / (BILATERAL_LEVELS - 1);
+
+    for (int level = 0; level < BILATERAL_LEVELS; level++)
+    {
+        double intensity = level * spacing;
+        range_luts[level].create(1, 256, CV_32F);
+        interp_luts[level].create(1, 256, CV_32F);
+
+        for (int value = 0; value < 256; value++)
+        {
+            double distance = (value - intensity) / spacing;
+            range_luts[level].at<float>(0, value) = (float)exp(-0.5 * distance * distance);
+            interp_luts[level].at<float>(0, value) = (float)max(0.0, 1.0 - fabs(distance));
+        }
+    }
+}
+
+/**
+ * True if size is a valid kernel size for kind. Median and Gaussian kernels
+ * must be odd. Checks without building a filter and its lookup tables.
+ */
+bool PreFilter::valid(enum PreFilterKind kind, int size)
+{
+    bool needs_odd = kind == PREFILTER_COLOR_MEDIAN ||
+                     kind == PREFILTER_MEDIAN ||
+                     kind == PREFILTER_GAUSSIAN;
+
+    return kind >= 0 && kind < NUM_PREFILTER_KINDS && size >= 1 && !(needs_odd && size % 2 == 0);
+}
+
+/**
+ * Selects the filter and its kernel size. Returns false and keeps the
+ * current filter if the size is invalid for the kind.
+ */
+bool PreFilter::configure(enum PreFilterKind new_kind, int new_size)
+{
+    if (!valid(new_kind, new_size))
+    {
+        return false;
+    }
+
+    kind = new_kind;
+    size = new_size;
+    return true;
+}
+
+enum PreFilterKind PreFilter::get_kind() const
+{
+    return kind;
+}
+
+int PreFilter::get_size() const
+{
+    return size;
+}
+
+/**
+ * Kernel size for an image scale relative to LANE_REFERENCE_WIDTH. Sizes are
+ * kept odd so they are valid for every kind.
+ */
+int PreFilter::scaled_size(double scale) const
+{
+    return max(3, (int)(size * scale) | 1);
+}
+
+/**
+ * Converts src to gray and filters it into dst with the given kernel size.
+ * Single channel sources skip the conversion. When a clock is given the
+ * conversion and the filter are charged to STAGE_GRAY and STAGE_BLUR.
+ */
+void PreFilter::apply(const cv::Mat& src, cv::Mat& dst, int kernel, StageClock* clock)
+{
+    if (kind == PREFILTER_COLOR_MEDIAN && src.channels() == 3)
+    {
+        cv::medianBlur(src, color_work, kernel);
+        if (clock)
+        {
+            clock->end_stage(STAGE_BLUR);
+        }
+
+        cv::cvtColor(color_work, dst, cv::COLOR_BGR2GRAY);
+        if (clock)
+        {
+            clock->end_stage(STAGE_GRAY);
+        }
+
+        return;
+    }
+
+    cv::Mat gray = src;
+    if (src.channels() == 3)
+    {
+        cv::cvtColor(src, color_work, cv::COLOR_BGR2GRAY);
+        gray = color_work;
+    }
+
+    if (clock)
+    {
+        clock->end_stage(STAGE_GRAY);
+    }
+
+    switch (kind)
+    {
+    case PREFILTER_BOX:
+        cv::blur(gray, dst, cv::Size(kernel, kernel));
+        break;
+
+    case PREFILTER_GAUSSIAN:
+        // sigma chosen so the kernel covers +/- 3 sigma
+        cv::GaussianBlur(gray, dst, cv::Size(kernel, kernel), kernel / 6.0);
+        break;
+
+    case PREFILTER_BILATERAL:
+        bilateral(gray, dst, kernel);
+        break;
+
+    default:
+        cv::medianBlur(gray, dst, kernel);
+        break;
+    }
+
+    if (clock)
+    {
+        clock->end_stage(STAGE_BLUR);
+    }
+}
+
+/**
+ * Piecewise linear bilateral filter (Durand and Dorsey). The image is
+ * filtered once against each of BILATERAL_LEVELS fixed intensities with a
+ * box kernel and every pixel interpolates between the results for the two
+ * levels nearest its own value. The cost does not depend on the kernel size.
+ */
+void PreFilter::bilateral(const cv::Mat& gray, cv::Mat& dst, int kernel)
+{
+    gray.convertTo(gray_f, CV_32F);
+    sum_f.create(gray.size(), CV_32F);
+    sum_f.setTo(cv::Scalar(0.0));
+
+    for (int level = 0; level < BILATERAL_LEVELS; level++)
+    {
+        cv::LUT(gray, range_luts[level], weight);
+        cv::multiply(weight, gray_f, weighted);
+        cv::blur(weighted, level_num, cv::Size(kernel, kernel));
+        cv::blur(weight, level_den, cv::Size(kernel, kernel));
+
+        // the range weight never reaches zero so the division is safe
+        cv::divide(level_num, level_den, level_num);
+        cv::LUT(gray, interp_luts[level], level_interp);
+        cv::multiply(level_num, level_interp, level_num);
+        cv::add(sum_f, level_num, sum_f);
+    }
+
+    sum_f.convertTo(dst, CV_8U);
+}
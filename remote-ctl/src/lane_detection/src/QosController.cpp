@@ -0,0 +1,118 @@
+#include "QosController.h"
+#include <algorithm>
+
+using namespace std;
+
+const char* QOS_LEVEL_NAMES[QOS_LEVELS] = { "full", "light_prefilter", "coarse_theta", "width_3/4", "width_1/2" };
+
+QosController::QosController(double deadline_ms) : deadline_ms(deadline_ms), level(0), misses(0), calm(0)
+{
+    stats.frames = 0;
+    stats.missed = 0;
+    stats.changes = 0;
+    fill(stats.level_frames, stats.level_frames + QOS_LEVELS, 0UL);
+}
+
+/**
+ * Counts a detected frame that took frame_ms at frame_level and moves the
+ * level if the deadline keeps being missed or met with room to spare.
+ * Returns true if the level changed.
+ */
+bool QosController::record(double frame_ms, int frame_level)
+{
+    bool missed = frame_ms > deadline_ms;
+
+    stats.frames++;
+    stats.missed += missed ? 1 : 0;
+    stats.level_frames[max(0, min(frame_level, QOS_LEVELS - 1))]++;
+
+    if (frame_level != level)
+    {
+        return false;
+    }
+
+    int step = 0;
+    if (missed)
+    {
+        calm = 0;
+        step = ++misses >= QOS_DOWN_AFTER && level < QOS_LEVELS - 1 ? 1 : 0;
+    }
+    else if (frame_ms < deadline_ms * QOS_HEADROOM)
+    {
+        misses = 0;
+        step = ++calm >= QOS_UP_AFTER && level > 0 ? -1 : 0;
+    }
+    else
+    {
+        // close to the deadline: hold the level
+        misses = 0;
+        calm = 0;
+    }
+
+    if (step == 0)
+    {
+        return false;
+    }
+
+    level += step;
+    misses = 0;
+    calm = 0;
+    stats.changes++;
+    return true;
+}
+
+int QosController::get_level() const
+{
+    return level;
+}
+
+double QosController::get_deadline() const
+{
+    return deadline_ms;
+}
+
+struct QosStats QosController::get_stats() const
+{
+    return stats;
+}
+
+/**
+ * True if QoS levels change the cost of detecting with params. The bird's
+ * eye engine warps to a fixed size and blurs with a fixed kernel, so none of
+ * the knobs qos_params() turns reach it.
+ */
+bool qos_supported(const struct LaneParams& params)
+{
+    return params.lane_engine == LANE_ENGINE_HOUGH;
+}
+
+/**
+ * Derives the tuning of a QoS level from the configured one. Steps are
+ * cumulative, cheapest loss of accuracy first: half the pre-filter kernel,
+ * then twice the Hough theta step, then a coarse pass at 3/4 and at 1/2 of
+ * the configured working width. A base without a coarse pass gets one at a
+ * fraction of half the reference width. Engines without QoS support always
+ * get level 0.
+ */
+void qos_params(const struct LaneParams& base, int level, struct LaneParams& params)
+{
+    params = base;
+    params.qos_level = qos_supported(base) ? max(0, min(level, QOS_LEVELS - 1)) : 0;
+
+    if (params.qos_level >= 1)
+    {
+        // odd sizes are valid for every pre-filter kind
+        params.set_prefilter(base.prefilter_kind, max(3, (base.prefilter_size / 2) | 1));
+    }
+
+    if (params.qos_level >= 2)
+    {
+        params.hough_theta_inc = base.hough_theta_inc * 2.0;
+    }
+
+    if (params.qos_level >= 3)
+    {
+        int width = base.working_width > 0 ? base.working_width : LANE_REFERENCE_WIDTH / 2;
+        params.working_width = params.qos_level >= 4 ? width / 2 : width * 3 / 4;
+    }
+}
@@ -0,0 +1,88 @@
+#include "RoadRegion.h"
+#include <algorithm>
+#include "opencv2/imgproc.hpp"
+
+using namespace std;
+
+/**
+ * The default region is everything below the top third of the image, which
+ * is what the detector has always looked at
+ */
+RoadRegion::RoadRegion()
+{
+    config.top = 1.0 / 3.0;
+    config.top_left = 0.0;
+    config.top_right = 1.0;
+    config.bottom_left = 0.0;
+    config.bottom_right = 1.0;
+}
+
+/**
+ * Replaces the region corners. Masks built for the previous corners are
+ * discarded and rebuilt on demand.
+ */
+void RoadRegion::configure(const struct RoadRegionConfig& new_config)
+{
+    config = new_config;
+    masks.clear();
+}
+
+const struct RoadRegionConfig& RoadRegion::get_config() const
+{
+    return config;
+}
+
+/**
+ * Returns the mask for an image size, rasterizing it the first time the size
+ * is seen. The returned reference stays valid until the next call with a
+ * new size or configure().
+ */
+const struct RoadMask& RoadRegion::get_mask(const cv::Size& size)
+{
+    for (const struct RoadMask& cached : masks)
+    {
+        if (cached.size == size)
+        {
+            return cached;
+        }
+    }
+
+    cv::Point corners[4] = {
+        cv::Point((int)(config.top_left * size.width), (int)(config.top * size.height)),
+        cv::Point((int)(config.top_right * size.width), (int)(config.top * size.height)),
+        cv::Point((int)(config.bottom_right * size.width), size.height),
+        cv::Point((int)(config.bottom_left * size.width), size.height)
+    };
+
+    int x1 = max(min(corners[0].x, corners[3].x), 0);
+    int x2 = min(max(corners[1].x, corners[2].x), size.width);
+    int y1 = max(min(corners[0].y, size.height - 1), 0);
+
+    struct RoadMask road;
+    road.size = size;
+    road.crop = cv::Rect(x1, y1, max(x2 - x1, 1), size.height - y1);
+    road.mask = cv::Mat::zeros(road.crop.height, road.crop.width, CV_8U);
+
+    for (cv::Point& corner : corners)
+    {
+        corner.x -= road.crop.x;
+        corner.y -= road.crop.y;
+    }
+
+    cv::fillConvexPoly(road.mask, corners, 4, cv::Scalar(255.0));
+
+    masks.push_back(road);
+    return masks.back();
+}
+
+/**
+ * Zeroes every pixel of an image outside a rectangle without touching the
+ * pixels inside it
+ */
+void clear_outside(cv::Mat& img, const cv::Rect& rect)
+{
+    img.rowRange(0, rect.y).setTo(cv::Scalar(0.0));
+    img.rowRange(rect.y + rect.height, img.rows).setTo(cv::Scalar(0.0));
+    img(cv::Rect(0, rect.y, rect.x, rect.height)).setTo(cv::Scalar(0.0));
+    img(cv::Rect(rect.x + rect.width, rect.y, img.cols - rect.x - rect.width, rect.height)).setTo(cv::Scalar(0.0));
+}
@@ -0,0 +1,78 @@
+#include "StageClock.h"
+#include <cstdio>
+
+using namespace std;
+
+const char* LANE_STAGE_NAMES[NUM_LANE_STAGES] = {
+    "wait", "resize", "gray", "blur", "canny", "hough", "refine", "track", "warp", "fit", "classify", "confidence",
+    "debug", "publish"
+};
+
+StageClock::StageClock()
+{
+    start();
+}
+
+/**
+ * Clears every stage total and starts timing the first stage
+ */
+void StageClock::start()
+{
+    for (int stage = 0; stage < NUM_LANE_STAGES; stage++)
+    {
+        stage_ms[stage] = 0.0;
+    }
+
+    stage_start = chrono::steady_clock::now();
+}
+
+/**
+ * Restarts timing without clearing the totals, so time spent between
+ * stages, e.g. queued for another thread, is not charged to the next stage
+ */
+void StageClock::resume()
+{
+    stage_start = chrono::steady_clock::now();
+}
+
+/**
+ * Adds the time since the previous stage ended to a stage's total
+ */
+void StageClock::end_stage(enum LaneStage stage)
+{
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    stage_ms[stage] += chrono::duration<double, milli>(now - stage_start).count();
+    stage_start = now;
+}
+
+/**
+ * Charges time measured elsewhere to a stage, without touching the running
+ * stage
+ */
+void StageClock::add(enum LaneStage stage, double ms)
+{
+    stage_ms[stage] += ms;
+}
+
+double StageClock::total_ms() const
+{
+    double total = 0.0;
+
+    for (int stage = 0; stage < NUM_LANE_STAGES; stage++)
+    {
+        total += stage_ms[stage];
+    }
+
+    return total;
+}
+
+void StageClock::print() const
+{
+    printf("Stage timings:");
+    for (int stage = 0; stage < NUM_LANE_STAGES; stage++)
+    {
+        printf("  %s %.2f", LANE_STAGE_NAMES[stage], stage_ms[stage]);
+    }
+    printf("\nProcessing took: %.2f msec after waiting %.2f msec\n", total_ms() - stage_ms[STAGE_WAIT],
+           stage_ms[STAGE_WAIT]);
+}
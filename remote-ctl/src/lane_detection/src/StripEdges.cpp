@@ -0,0 +1,107 @@
+#include "StripEdges.h"
+#include <algorithm>
+#include "opencv2/imgproc.hpp"
+
+using namespace std;
+
+/// Body of cv::parallel_for_ over strip indices
+class StripBody : public cv::ParallelLoopBody
+{
+private:
+    const cv::Mat& src;
+    cv::Mat& edges;
+    vector<struct StripBuffers>& strips;
+    int strip_rows;
+    int kernel;
+    double canny_low;
+    double canny_high;
+
+public:
+    StripBody(const cv::Mat& src, cv::Mat& edges, vector<struct StripBuffers>& strips, int strip_rows,
+              int kernel, double canny_low, double canny_high) :
+        src(src), edges(edges), strips(strips), strip_rows(strip_rows), kernel(kernel),
+        canny_low(canny_low), canny_high(canny_high)
+    {
+    }
+
+    /**
+     * Runs every stage on the strips in range. Each strip is widened by halo
+     * rows so the blur and Canny see the same neighbourhood as in a full
+     * image pass, and only its own rows are copied out.
+     */
+    virtual void operator()(const cv::Range& range) const
+    {
+        int halo = kernel / 2 + STRIP_CANNY_HALO;
+
+        for (int index = range.start; index < range.end; index++)
+        {
+            struct StripBuffers& strip = strips[index];
+            int top = index * strip_rows;
+            int bottom = min(src.rows, top + strip_rows);
+            int outer_top = max(0, top - halo);
+            int outer_bottom = min(src.rows, bottom + halo);
+
+            strip.prefilter.apply(src.rowRange(outer_top, outer_bottom), strip.gray, kernel);
+            cv::Canny(strip.gray, strip.edges, canny_low, canny_high);
+
+            cv::Mat strip_edges = edges.rowRange(top, bottom);
+            strip.edges.rowRange(top - outer_top, bottom - outer_top).copyTo(strip_edges);
+        }
+    }
+};
+
+StripEdges::StripEdges() : strip_rows(0)
+{
+}
+
+/**
+ * Sets the strip height in rows. 0 or less filters the whole image in one
+ * pass.
+ */
+void StripEdges::configure(int new_strip_rows)
+{
+    strip_rows = max(0, new_strip_rows);
+}
+
+int StripEdges::get_strip_rows() const
+{
+    return strip_rows;
+}
+
+/**
+ * Converts src to gray, filters it with the kind and size of prefilter at the
+ * given kernel size and runs Canny, writing edges the size of src. Without a
+ * strip height this is a plain full image pass on the calling thread.
+ */
+void StripEdges::detect(const PreFilter& prefilter, const cv::Mat& src, cv::Mat& edges, int kernel,
+                        double canny_low, double canny_high)
+{
+    int rows = strip_rows > 0 ? min(strip_rows, src.rows) : src.rows;
+    int num_strips = (src.rows + rows - 1) / rows;
+
+    if ((int)strips.size() < num_strips)
+    {
+        strips.resize(num_strips);
+    }
+
+    for (int index = 0; index < num_strips; index++)
+    {
+        PreFilter& strip_filter = strips[index].prefilter;
+        if (strip_filter.get_kind() != prefilter.get_kind() || strip_filter.get_size() != prefilter.get_size())
+        {
+            strip_filter.configure(prefilter.get_kind(), prefilter.get_size());
+        }
+    }
+
+    // strips write straight into their rows, so edges must exist up front
+    edges.create(src.size(), CV_8U);
+
+    StripBody body(src, edges, strips, rows, kernel, canny_low, canny_high);
+    if (num_strips == 1)
+    {
+        body(cv::Range(0, 1));
+        return;
+    }
+
+    cv::parallel_for_(cv::Range(0, num_strips), body, num_strips);
+}
@@ -0,0 +1,223 @@
+#include "WorkerPool.h"
+#include <stdexcept>
+#include <string>
+#include <cerrno>
+
+using namespace std;
+
+/// Completion tracking for the indices of one parallel_for() call
+struct ParallelBatch
+{
+    int remaining;
+    pthread_mutex_t done_lock;
+    pthread_cond_t done;
+};
+
+void* worker_loop(void* pool_ptr)
+{
+    WorkerPool* pool = (WorkerPool*)pool_ptr;
+    struct WorkerTask task;
+
+    while (pool->next_task(task))
+    {
+        WorkerPool::run_task(task);
+    }
+
+    return NULL;
+}
+
+WorkerPool::WorkerPool(int num_threads) : running(true)
+{
+    if (pthread_mutex_init(&queue_lock, NULL) != 0 || pthread_cond_init(&task_ready, NULL) != 0)
+    {
+        throw runtime_error("WorkerPool: failed to initialize the task queue");
+    }
+
+    for (int index = 0; index < num_threads; index++)
+    {
+        pthread_t thread;
+        int status = pthread_create(&thread, NULL, &worker_loop, (void*)this);
+
+        if (status != 0)
+        {
+            stop();
+            throw runtime_error(string("pthread_create(): failed to start worker thread: ") + to_string(status));
+        }
+
+        threads.push_back(thread);
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    stop();
+}
+
+/**
+ * Stops the workers once every queued task has run
+ */
+void WorkerPool::stop()
+{
+    pthread_mutex_lock(&queue_lock);
+    running = false;
+    pthread_cond_broadcast(&task_ready);
+    pthread_mutex_unlock(&queue_lock);
+
+    for (pthread_t thread : threads)
+    {
+        pthread_join(thread, NULL);
+    }
+
+    threads.clear();
+    pthread_cond_destroy(&task_ready);
+    pthread_mutex_destroy(&queue_lock);
+}
+
+int WorkerPool::size() const
+{
+    return (int)threads.size();
+}
+
+/**
+ * Blocks until a task is queued and takes it. Returns false once the pool
+ * is shutting down and the queue is empty.
+ */
+bool WorkerPool::next_task(struct WorkerTask& task)
+{
+    pthread_mutex_lock(&queue_lock);
+
+    while (running && tasks.empty())
+    {
+        pthread_cond_wait(&task_ready, &queue_lock);
+    }
+
+    bool have_task = !tasks.empty();
+    if (have_task)
+    {
+        task = tasks.front();
+        tasks.pop_front();
+    }
+
+    pthread_mutex_unlock(&queue_lock);
+
+    return have_task;
+}
+
+void WorkerPool::run_task(struct WorkerTask& task)
+{
+    if (!task.batch)
+    {
+        task.job();
+        return;
+    }
+
+    (*task.body)(task.index);
+
+    pthread_mutex_lock(&task.batch->done_lock);
+    if (--task.batch->remaining == 0)
+    {
+        pthread_cond_signal(&task.batch->done);
+    }
+    pthread_mutex_unlock(&task.batch->done_lock);
+}
+
+/**
+ * Queues a job to run on one of the workers and returns immediately
+ */
+void WorkerPool::submit(const function<void()>& job)
+{
+    struct WorkerTask task;
+    task.job = job;
+    task.body = NULL;
+    task.index = 0;
+    task.batch = NULL;
+
+    pthread_mutex_lock(&queue_lock);
+    tasks.push_back(task);
+    pthread_cond_signal(&task_ready);
+    pthread_mutex_unlock(&queue_lock);
+}
+
+/**
+ * Takes a queued task belonging to a batch, if there is one left
+ */
+bool WorkerPool::steal_task(struct ParallelBatch* batch, struct WorkerTask& task)
+{
+    bool have_task = false;
+
+    pthread_mutex_lock(&queue_lock);
+
+    for (deque<struct WorkerTask>::iterator queued = tasks.begin(); queued != tasks.end(); ++queued)
+    {
+        if (queued->batch == batch)
+        {
+            task = *queued;
+            tasks.erase(queued);
+            have_task = true;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&queue_lock);
+
+    return have_task;
+}
+
+/**
+ * Runs body(0) .. body(count - 1) and returns once all of them finished.
+ * Index 0 runs on the calling thread, the rest are spread over the workers.
+ * While waiting, the caller also runs indices no worker has picked up yet,
+ * so this is safe to call from inside a pool task. A pool without threads
+ * runs everything on the caller.
+ */
+void WorkerPool::parallel_for(int count, const function<void(int)>& body)
+{
+    if (count <= 0)
+    {
+        return;
+    }
+
+    if (threads.empty() || count == 1)
+    {
+        for (int index = 0; index < count; index++)
+        {
+            body(index);
+        }
+        return;
+    }
+
+    struct ParallelBatch batch;
+    batch.remaining = count - 1;
+    pthread_mutex_init(&batch.done_lock, NULL);
+    pthread_cond_init(&batch.done, NULL);
+
+    pthread_mutex_lock(&queue_lock);
+    for (int index = 1; index < count; index++)
+    {
+        struct WorkerTask task;
+        task.body = &body;
+        task.index = index;
+        task.batch = &batch;
+        tasks.push_back(task);
+    }
+    pthread_cond_broadcast(&task_ready);
+    pthread_mutex_unlock(&queue_lock);
+
+    body(0);
+
+    struct WorkerTask task;
+    while (steal_task(&batch, task))
+    {
+        run_task(task);
+    }
+
+    pthread_mutex_lock(&batch.done_lock);
+    while (batch.remaining > 0)
+    {
+        pthread_cond_wait(&batch.done, &batch.done_lock);
+    }
+    pthread_mutex_unlock(&batch.done_lock);
+
+    pthread_cond_destroy(&batch.done);
+    pthread_mutex_destroy(&batch.done_lock);
+}
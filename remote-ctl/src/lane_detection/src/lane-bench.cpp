@@ -0,0 +1,1226 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <unistd.h>
+#include "opencv2/core.hpp"
+#include "opencv2/imgproc.hpp"
+#include "FrameSource.h"
+#include "PreFilter.h"
+#include "RoadRegion.h"
+#include "HoughBands.h"
+#include "WorkerPool.h"
+#include "BirdsEye.h"
+#include "StripEdges.h"
+#include "LaneCore.h"
+#include "LatencyHistogram.h"
+#include "LaneEvaluation.h"
+#include "LaneTuner.h"
+#include "LaneStreams.h"
+#include "FrameRecording.h"
+#include "QosController.h"
+
+using namespace std;
+
+// detector defaults used to prepare edge maps, taken from the core so the
+// benchmarks cannot drift from what the node runs
+static const struct LaneParams DEFAULT_PARAMS;
+const int CANNY_CONT_THRESH = DEFAULT_PARAMS.canny_cont_thresh;
+const int CANNY_GRAD_THRESH = DEFAULT_PARAMS.canny_grad_thresh;
+const double HOUGH_RADIUS_INC = DEFAULT_PARAMS.hough_radius_inc;
+const double HOUGH_THETA_INC = DEFAULT_PARAMS.hough_theta_inc;
+const int HOUGH_MIN_VOTES = DEFAULT_PARAMS.hough_min_votes;
+
+struct TimingSummary
+{
+    double mean_ms;
+    double p50_ms;
+    double max_ms;
+};
+
+static struct TimingSummary summarize(vector<double> samples)
+{
+    struct TimingSummary summary = { 0.0, 0.0, 0.0 };
+
+    if (samples.empty())
+    {
+        return summary;
+    }
+
+    sort(samples.begin(), samples.end());
+    for (double sample : samples)
+    {
+        summary.mean_ms += sample;
+    }
+
+    summary.mean_ms /= (double)samples.size();
+    summary.p50_ms = samples[samples.size() / 2];
+    summary.max_ms = samples.back();
+    return summary;
+}
+
+static double elapsed_ms(const chrono::steady_clock::time_point& start)
+{
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * Times every pre-filter kind on the road region of the same frames. The
+ * color median at the same size is the path the detector originally used
+ * and is the baseline for the speedup column.
+ */
+static int bench_prefilter(const vector<cv::Mat>& frames, int size)
+{
+    RoadRegion road_region;
+    vector<struct TimingSummary> results;
+
+    printf("%-14s %10s %10s %10s %9s\n", "filter", "mean ms", "p50 ms", "max ms", "speedup");
+
+    for (int kind = 0; kind < NUM_PREFILTER_KINDS; kind++)
+    {
+        PreFilter prefilter;
+        if (!prefilter.configure((enum PreFilterKind)kind, size))
+        {
+            printf("%-14s invalid size %d\n", PREFILTER_NAMES[kind], size);
+            return EXIT_FAILURE;
+        }
+
+        cv::Mat filtered;
+        vector<double> samples;
+
+        // first pass warms up caches and buffers and is not counted
+        for (int pass = 0; pass < 2; pass++)
+        {
+            for (const cv::Mat& frame : frames)
+            {
+                const struct RoadMask& road = road_region.get_mask(frame.size());
+                int kernel = prefilter.scaled_size((double)frame.cols / LANE_REFERENCE_WIDTH);
+
+                chrono::steady_clock::time_point start = chrono::steady_clock::now();
+                prefilter.apply(frame(road.crop), filtered, kernel);
+
+                if (pass > 0)
+                {
+                    samples.push_back(elapsed_ms(start));
+                }
+            }
+        }
+
+        results.push_back(summarize(samples));
+        printf("%-14s %10.3f %10.3f %10.3f %8.2fx\n",
+               PREFILTER_NAMES[kind],
+               results.back().mean_ms,
+               results.back().p50_ms,
+               results.back().max_ms,
+               results[PREFILTER_COLOR_MEDIAN].mean_ms / results.back().mean_ms);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Runs the default pre-filter and Canny on the road region of every frame
+ */
+static void prepare_edges(const vector<cv::Mat>& frames, vector<cv::Mat>& edges, vector<cv::Point>& offsets)
+{
+    RoadRegion road_region;
+    PreFilter prefilter;
+    cv::Mat filtered;
+
+    for (const cv::Mat& frame : frames)
+    {
+        const struct RoadMask& road = road_region.get_mask(frame.size());
+        cv::Mat edge_img;
+
+        prefilter.apply(frame(road.crop), filtered, prefilter.scaled_size((double)frame.cols / LANE_REFERENCE_WIDTH));
+        cv::Canny(filtered, edge_img, CANNY_CONT_THRESH, CANNY_GRAD_THRESH);
+        cv::bitwise_and(edge_img, road.mask, edge_img);
+
+        edges.push_back(edge_img);
+        offsets.push_back(road.crop.tl());
+    }
+}
+
+static bool same_lines(const vector<cv::Vec2d>& a, const vector<cv::Vec2d>& b)
+{
+    return a.size() == b.size() &&
+           equal(a.begin(), a.end(), b.begin(),
+                 [](const cv::Vec2d& x, const cv::Vec2d& y) { return x[0] == y[0] && x[1] == y[1]; });
+}
+
+/**
+ * Times Hough voting and peak extraction on the same edge maps with 1 to
+ * max_threads threads and checks every thread count finds the same lines
+ */
+static int bench_hough(const vector<cv::Mat>& frames, int max_threads)
+{
+    vector<cv::Mat> edges;
+    vector<cv::Point> offsets;
+    prepare_edges(frames, edges, offsets);
+
+    WorkerPool pool(max_threads - 1);
+    vector<vector<cv::Vec2d> > reference(frames.size());
+    double single_thread_ms = 0.0;
+    bool consistent = true;
+
+    printf("%-8s %10s %10s %10s %9s\n", "threads", "mean ms", "p50 ms", "max ms", "speedup");
+
+    for (int threads = 1; threads <= max_threads; threads++)
+    {
+        HoughBands hough;
+        hough.set_parallel(&pool, threads);
+        vector<double> samples;
+        vector<cv::Vec2d> lines;
+
+        for (int pass = 0; pass < 2; pass++)
+        {
+            for (size_t index = 0; index < edges.size(); index++)
+            {
+                const cv::Mat& edge_img = edges[index];
+                hough.configure(lane_theta_bands(), -frames[index].cols,
+                                hypot((double)frames[index].cols, (double)frames[index].rows),
+                                HOUGH_RADIUS_INC, HOUGH_THETA_INC);
+
+                chrono::steady_clock::time_point start = chrono::steady_clock::now();
+                hough.detect(edge_img, offsets[index], HOUGH_MIN_VOTES, lines);
+
+                if (pass == 0)
+                {
+                    continue;
+                }
+
+                samples.push_back(elapsed_ms(start));
+
+                if (threads == 1)
+                {
+                    reference[index] = lines;
+                }
+                else if (!same_lines(lines, reference[index]))
+                {
+                    consistent = false;
+                }
+            }
+        }
+
+        struct TimingSummary summary = summarize(samples);
+        if (threads == 1)
+        {
+            single_thread_ms = summary.mean_ms;
+        }
+
+        printf("%-8d %10.3f %10.3f %10.3f %8.2fx\n",
+               threads, summary.mean_ms, summary.p50_ms, summary.max_ms, single_thread_ms / summary.mean_ms);
+    }
+
+    if (!consistent)
+    {
+        printf("\nLines differ between thread counts!\n");
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Times float and fixed-point Hough voting on the same edge maps on one
+ * thread and counts the frames where they find different lines. Differences
+ * come from points that lie within a rounding error of a radius bin boundary.
+ */
+static int bench_fixed(const vector<cv::Mat>& frames)
+{
+    vector<cv::Mat> edges;
+    vector<cv::Point> offsets;
+    prepare_edges(frames, edges, offsets);
+
+    vector<vector<cv::Vec2d> > reference(frames.size());
+    double float_ms = 0.0;
+    int differing_frames = 0;
+
+    printf("%-8s %10s %10s %10s %9s\n", "voting", "mean ms", "p50 ms", "max ms", "speedup");
+
+    for (int fixed_point = 0; fixed_point < 2; fixed_point++)
+    {
+        HoughBands hough;
+        hough.set_fixed_point(fixed_point != 0);
+        vector<double> samples;
+        vector<cv::Vec2d> lines;
+
+        for (int pass = 0; pass < 2; pass++)
+        {
+            for (size_t index = 0; index < edges.size(); index++)
+            {
+                hough.configure(lane_theta_bands(), -frames[index].cols,
+                                hypot((double)frames[index].cols, (double)frames[index].rows),
+                                HOUGH_RADIUS_INC, HOUGH_THETA_INC);
+
+                chrono::steady_clock::time_point start = chrono::steady_clock::now();
+                hough.detect(edges[index], offsets[index], HOUGH_MIN_VOTES, lines);
+
+                if (pass == 0)
+                {
+                    continue;
+                }
+
+                samples.push_back(elapsed_ms(start));
+
+                if (!fixed_point)
+                {
+                    reference[index] = lines;
+                }
+                else if (!same_lines(lines, reference[index]))
+                {
+                    differing_frames++;
+                }
+            }
+        }
+
+        struct TimingSummary summary = summarize(samples);
+        if (!fixed_point)
+        {
+            float_ms = summary.mean_ms;
+        }
+
+        printf("%-8s %10.3f %10.3f %10.3f %8.2fx\n", fixed_point ? "fixed" : "float",
+               summary.mean_ms, summary.p50_ms, summary.max_ms, float_ms / summary.mean_ms);
+    }
+
+    printf("\nFixed-point lines differ from float on %d of %lu frames\n", differing_frames, frames.size());
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Replays the frames in order through a full vote per frame and through
+ * incremental updates rebuilt every rebuild_interval frames, and checks both
+ * find the same lines. The frames must be a recorded sequence for the
+ * incremental numbers to mean anything.
+ */
+static int bench_incremental(const vector<cv::Mat>& frames, int rebuild_interval)
+{
+    vector<cv::Mat> edges;
+    vector<cv::Point> offsets;
+    prepare_edges(frames, edges, offsets);
+
+    vector<vector<cv::Vec2d> > reference(frames.size());
+    double full_ms = 0.0;
+    bool consistent = true;
+
+    printf("%-12s %10s %10s %10s %11s %9s %9s\n",
+           "mode", "mean ms", "p50 ms", "max ms", "pts voted", "rebuilds", "speedup");
+
+    for (int incremental = 0; incremental < 2; incremental++)
+    {
+        HoughBands hough;
+        vector<double> samples;
+        vector<cv::Vec2d> lines;
+        long points_voted = 0;
+        int rebuilds = 0;
+
+        for (size_t index = 0; index < edges.size(); index++)
+        {
+            hough.configure(lane_theta_bands(), -frames[index].cols,
+                            hypot((double)frames[index].cols, (double)frames[index].rows),
+                            HOUGH_RADIUS_INC, HOUGH_THETA_INC);
+
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            if (incremental)
+            {
+                rebuilds += hough.update(edges[index], offsets[index], rebuild_interval) ? 1 : 0;
+                hough.find_lines(HOUGH_MIN_VOTES, lines);
+            }
+            else
+            {
+                hough.detect(edges[index], offsets[index], HOUGH_MIN_VOTES, lines);
+                rebuilds++;
+            }
+            samples.push_back(elapsed_ms(start));
+            points_voted += hough.num_points_voted();
+
+            if (!incremental)
+            {
+                reference[index] = lines;
+            }
+            else if (!same_lines(lines, reference[index]))
+            {
+                consistent = false;
+            }
+        }
+
+        struct TimingSummary summary = summarize(samples);
+        if (!incremental)
+        {
+            full_ms = summary.mean_ms;
+        }
+
+        printf("%-12s %10.3f %10.3f %10.3f %11ld %9d %8.2fx\n",
+               incremental ? "incremental" : "full",
+               summary.mean_ms, summary.p50_ms, summary.max_ms,
+               points_voted / (long)edges.size(), rebuilds, full_ms / summary.mean_ms);
+    }
+
+    if (!consistent)
+    {
+        printf("\nIncremental lines differ from a full vote!\n");
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Times both lane engines from color frame to lines. The Hough engine is the
+ * full resolution path: pre-filter, Canny and Hough over the road region.
+ * The bird's eye engine warps, finds edges and fits polynomials.
+ */
+static int bench_engines(const vector<cv::Mat>& frames)
+{
+    RoadRegion road_region;
+    PreFilter prefilter;
+    HoughBands hough;
+    BirdsEye birds_eye;
+    cv::Mat filtered;
+    cv::Mat edge_img;
+    vector<cv::Vec2d> lines;
+    struct LaneFit fit;
+    vector<double> hough_samples;
+    vector<double> birds_eye_samples;
+    int birds_eye_found = 0;
+
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (const cv::Mat& frame : frames)
+        {
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            const struct RoadMask& road = road_region.get_mask(frame.size());
+            prefilter.apply(frame(road.crop), filtered, prefilter.scaled_size((double)frame.cols / LANE_REFERENCE_WIDTH));
+            cv::Canny(filtered, edge_img, CANNY_CONT_THRESH, CANNY_GRAD_THRESH);
+            cv::bitwise_and(edge_img, road.mask, edge_img);
+            hough.configure(lane_theta_bands(), -frame.cols, hypot((double)frame.cols, (double)frame.rows),
+                            HOUGH_RADIUS_INC, HOUGH_THETA_INC);
+            hough.detect(edge_img, road.crop.tl(), HOUGH_MIN_VOTES, lines);
+            double hough_ms = elapsed_ms(start);
+
+            start = chrono::steady_clock::now();
+            birds_eye.detect(frame, CANNY_CONT_THRESH, CANNY_GRAD_THRESH, fit);
+            double birds_eye_ms = elapsed_ms(start);
+
+            if (pass > 0)
+            {
+                hough_samples.push_back(hough_ms);
+                birds_eye_samples.push_back(birds_eye_ms);
+                birds_eye_found += fit.found ? 1 : 0;
+            }
+        }
+    }
+
+    struct TimingSummary hough_summary = summarize(hough_samples);
+    struct TimingSummary birds_eye_summary = summarize(birds_eye_samples);
+
+    printf("%-10s %10s %10s %10s %9s\n", "engine", "mean ms", "p50 ms", "max ms", "speedup");
+    printf("%-10s %10.3f %10.3f %10.3f %8.2fx\n", "hough",
+           hough_summary.mean_ms, hough_summary.p50_ms, hough_summary.max_ms, 1.0);
+    printf("%-10s %10.3f %10.3f %10.3f %8.2fx\n", "birds_eye",
+           birds_eye_summary.mean_ms, birds_eye_summary.p50_ms, birds_eye_summary.max_ms,
+           hough_summary.mean_ms / birds_eye_summary.mean_ms);
+    printf("\nBird's eye lane found in %d of %lu frames with the default calibration\n",
+           birds_eye_found, frames.size());
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Times the gray, pre-filter and Canny pass of the road region with each
+ * strip height, full image stage by stage first as the baseline. Edge pixels
+ * that differ from the baseline come from hysteresis crossing strip
+ * boundaries further than the halo.
+ */
+static int bench_strips(const vector<cv::Mat>& frames, int threads)
+{
+    const int STRIP_ROWS[] = { 0, 8, 16, 32, 48, 64, 96, 128, 256 };
+    const int NUM_STRIP_ROWS = sizeof(STRIP_ROWS) / sizeof(STRIP_ROWS[0]);
+
+    if (threads > 0)
+    {
+        cv::setNumThreads(threads);
+    }
+
+    RoadRegion road_region;
+    PreFilter prefilter;
+    vector<cv::Mat> baseline(frames.size());
+    double baseline_ms = 0.0;
+
+    printf("OpenCV threads: %d\n", cv::getNumThreads());
+    printf("%-10s %10s %10s %10s %9s %14s\n", "strip rows", "mean ms", "p50 ms", "max ms", "speedup", "edge mismatch");
+
+    for (int size = 0; size < NUM_STRIP_ROWS; size++)
+    {
+        StripEdges strip_edges;
+        strip_edges.configure(STRIP_ROWS[size]);
+        vector<double> samples;
+        unsigned long mismatched = 0;
+        cv::Mat gray;
+        cv::Mat edges;
+        cv::Mat difference;
+
+        // first pass warms up caches and buffers and is not counted
+        for (int pass = 0; pass < 2; pass++)
+        {
+            for (size_t index = 0; index < frames.size(); index++)
+            {
+                const struct RoadMask& road = road_region.get_mask(frames[index].size());
+                int kernel = prefilter.scaled_size((double)frames[index].cols / LANE_REFERENCE_WIDTH);
+
+                chrono::steady_clock::time_point start = chrono::steady_clock::now();
+                if (STRIP_ROWS[size] == 0)
+                {
+                    prefilter.apply(frames[index](road.crop), gray, kernel);
+                    cv::Canny(gray, edges, CANNY_CONT_THRESH, CANNY_GRAD_THRESH);
+                }
+                else
+                {
+                    strip_edges.detect(prefilter, frames[index](road.crop), edges, kernel,
+                                       CANNY_CONT_THRESH, CANNY_GRAD_THRESH);
+                }
+
+                if (pass == 0)
+                {
+                    continue;
+                }
+
+                samples.push_back(elapsed_ms(start));
+                if (STRIP_ROWS[size] == 0)
+                {
+                    edges.copyTo(baseline[index]);
+                }
+                else
+                {
+                    cv::absdiff(edges, baseline[index], difference);
+                    mismatched += (unsigned long)cv::countNonZero(difference);
+                }
+            }
+        }
+
+        struct TimingSummary summary = summarize(samples);
+        if (STRIP_ROWS[size] == 0)
+        {
+            baseline_ms = summary.mean_ms;
+            printf("%-10s", "full");
+        }
+        else
+        {
+            printf("%-10d", STRIP_ROWS[size]);
+        }
+
+        printf(" %10.3f %10.3f %10.3f %8.2fx %14lu\n", summary.mean_ms, summary.p50_ms, summary.max_ms,
+               baseline_ms / summary.mean_ms, mismatched);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Prints the latency of every stage that ran and its share of the frame time
+ */
+static void print_stage_latency(const LatencyHistogram stage_latency[NUM_LANE_STAGES],
+                                const LatencyHistogram& frame_latency)
+{
+    struct LatencySummary frame = frame_latency.summarize();
+    printf("%-12s %8s %10s %10s %10s %10s %10s %7s\n", "stage", "frames", "mean ms", "p50 ms", "p95 ms",
+           "p99 ms", "max ms", "share");
+
+    for (int stage = 0; stage < NUM_LANE_STAGES; stage++)
+    {
+        struct LatencySummary summary = stage_latency[stage].summarize();
+        if (summary.count == 0)
+        {
+            continue;
+        }
+
+        printf("%-12s %8lu %10.3f %10.3f %10.3f %10.3f %10.3f %6.1f%%\n", LANE_STAGE_NAMES[stage],
+               summary.count, summary.mean_ms, summary.p50_ms, summary.p95_ms, summary.p99_ms, summary.max_ms,
+               summary.mean_ms * summary.count * 100.0 / (frame.mean_ms * frame.count));
+    }
+
+    printf("%-12s %8lu %10.3f %10.3f %10.3f %10.3f %10.3f\n", "total", frame.count, frame.mean_ms,
+           frame.p50_ms, frame.p95_ms, frame.p99_ms, frame.max_ms);
+}
+
+/**
+ * Runs the whole lane core, as the node does on every camera frame, over the
+ * frames as fast as possible and reports the frame rate and the latency of
+ * every stage. The first pass warms up buffers and the tracker and is not
+ * counted. With luma the frames are reduced to gray before timing, like the
+ * node's ~luma_only mode receives them.
+ */
+static int bench_pipeline(const vector<cv::Mat>& color_frames, const string& engine, int threads, bool luma)
+{
+    vector<cv::Mat> luma_frames;
+    if (luma)
+    {
+        luma_frames.resize(color_frames.size());
+        for (size_t index = 0; index < color_frames.size(); index++)
+        {
+            cv::cvtColor(color_frames[index], luma_frames[index], cv::COLOR_BGR2GRAY);
+        }
+    }
+    const vector<cv::Mat>& frames = luma ? luma_frames : color_frames;
+
+    WorkerPool pool(max(0, threads - 1));
+    LaneCore core(&pool);
+    core.verbose = false;
+    core.params.hough_threads = threads;
+    if (!core.params.set_lane_engine(engine))
+    {
+        printf("Unknown lane engine %s\n", engine.c_str());
+        return EXIT_FAILURE;
+    }
+
+    struct LaneFilters filters;
+    struct LaneWorkspace work;
+    work.filters = &filters;
+
+    LatencyHistogram stage_latency[NUM_LANE_STAGES];
+    LatencyHistogram frame_latency;
+    unsigned long found = 0;
+    double elapsed = 0.0;
+
+    for (int pass = 0; pass < 2; pass++)
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+        for (size_t index = 0; index < frames.size(); index++)
+        {
+            work.sequence = index + 1;
+            core.prepare(frames[index], work);
+            core.detect(work);
+
+            if (pass == 0)
+            {
+                continue;
+            }
+
+            for (int stage = 0; stage < NUM_LANE_STAGES; stage++)
+            {
+                if (work.clock.stage_ms[stage] > 0.0)
+                {
+                    stage_latency[stage].record(work.clock.stage_ms[stage]);
+                }
+            }
+            frame_latency.record(work.clock.total_ms());
+            found += work.pose.confidence > 0.0 ? 1 : 0;
+        }
+
+        elapsed = elapsed_ms(start);
+    }
+
+    printf("Engine: %s   threads: %d   input: %s\n", LANE_ENGINE_NAMES[core.params.lane_engine], threads,
+           luma ? "luma" : "color");
+    printf("Frames: %lu   %.1f fps   lane found in %.1f%%\n\n", frames.size(),
+           frames.size() * 1000.0 / elapsed, found * 100.0 / frames.size());
+    print_stage_latency(stage_latency, frame_latency);
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Scores the lane core with the given settings against labeled frames and
+ * checks the result against a baseline of a known good run. Settings are
+ * name=value pairs using the node's parameter names. Without a baseline file,
+ * or with --update, the run is recorded as the new baseline instead.
+ */
+static int bench_regress(const vector<cv::Mat>& frames, const string& labels_path, const string& baseline_path,
+                         const vector<string>& options)
+{
+    vector<struct LaneLabel> labels;
+    if (!load_lane_labels(labels_path, frames.size(), labels))
+    {
+        return EXIT_FAILURE;
+    }
+
+    LaneCore core;
+    core.verbose = false;
+    bool update = false;
+
+    for (const string& option : options)
+    {
+        size_t equals = option.find('=');
+        if (option == "--update")
+        {
+            update = true;
+        }
+        else if (equals == string::npos || !core.params.set_option(option.substr(0, equals), option.substr(equals + 1)))
+        {
+            printf("Invalid setting %s\n", option.c_str());
+            return EXIT_FAILURE;
+        }
+    }
+
+    struct LaneFilters filters;
+    struct LaneEvaluation result = evaluate_lanes(core, filters, frames, labels);
+
+    printf("Lane frames: %lu   detected: %lu (%.1f%%)\n", result.lane_frames, result.detected,
+           result.detection_rate * 100.0);
+    printf("Empty frames: %lu   false detections: %lu (%.1f%%)\n", result.empty_frames, result.false_detections,
+           result.false_rate * 100.0);
+    printf("Offset error: mean %.2f px   p95 %.2f px\n", result.mean_offset_error, result.p95_offset_error);
+    printf("Frame latency: mean %.3f ms   p50 %.3f ms   p95 %.3f ms   p99 %.3f ms   max %.3f ms\n\n",
+           result.latency.mean_ms, result.latency.p50_ms, result.latency.p95_ms, result.latency.p99_ms,
+           result.latency.max_ms);
+
+    struct LaneBaseline baseline;
+    if (update || !load_lane_baseline(baseline_path, baseline))
+    {
+        if (!save_lane_baseline(baseline_path, result))
+        {
+            return EXIT_FAILURE;
+        }
+
+        printf("Recorded baseline %s\n", baseline_path.c_str());
+        return EXIT_SUCCESS;
+    }
+
+    if (!check_lane_baseline(result, baseline))
+    {
+        return EXIT_FAILURE;
+    }
+
+    printf("PASS against baseline %s\n", baseline_path.c_str());
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Sweeps the settings listed in sweep_path over the labeled frames on every
+ * core and writes the Pareto front of accuracy against latency to
+ * config_path, in the format the node loads with ~tuned_config
+ */
+static int bench_tune(const vector<cv::Mat>& frames, const string& labels_path, const string& sweep_path,
+                      const string& config_path, int threads)
+{
+    vector<struct LaneLabel> labels;
+    vector<struct SweepParameter> sweep;
+    if (!load_lane_labels(labels_path, frames.size(), labels) || !load_lane_sweep(sweep_path, sweep))
+    {
+        return EXIT_FAILURE;
+    }
+
+    WorkerPool pool(threads - 1);
+    vector<struct TuneResult> results;
+    vector<const struct TuneResult*> front;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    tune_lanes(sweep, frames, labels, pool, threads, results);
+    pareto_front(results, front);
+
+    printf("\nSwept %lu combinations in %.1f s. Pareto front, most accurate first:\n", results.size(),
+           elapsed_ms(start) / 1000.0);
+    printf("%-6s %9s %10s %10s %10s  %s\n", "point", "accuracy", "offset px", "mean ms", "p95 ms", "settings");
+
+    for (size_t point = 0; point < front.size(); point++)
+    {
+        string settings;
+        for (const pair<string, string>& setting : front[point]->settings)
+        {
+            settings += setting.first + "=" + setting.second + " ";
+        }
+
+        printf("%-6lu %9.4f %10.2f %10.3f %10.3f  %s\n", point, front[point]->accuracy,
+               front[point]->evaluation.mean_offset_error, front[point]->evaluation.latency.mean_ms,
+               front[point]->evaluation.latency.p95_ms, settings.c_str());
+    }
+
+    if (!save_lane_config(config_path, front))
+    {
+        return EXIT_FAILURE;
+    }
+
+    printf("\nWrote %s\n", config_path.c_str());
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Replays the frames into several cameras at once, the way the node's
+ * multi-camera mode receives them. Every tick at fps each camera is handed
+ * its next frame, the cameras starting at different points of the recording
+ * so they see different scenes, and all of them are detected on one shared
+ * pool of threads workers. fps 0 hands frames over as fast as they can be
+ * copied, so most are overwritten before a worker gets to them.
+ */
+static int bench_streams(const vector<cv::Mat>& frames, int cameras, int threads, double fps)
+{
+    WorkerPool pool(threads);
+    LaneStreams streams(pool, [](struct LaneStream&) {});
+    streams.max_frame_age_ms = 0;
+
+    for (int camera = 0; camera < cameras; camera++)
+    {
+        struct LaneStream& stream = streams.add_stream("camera" + to_string(camera));
+        stream.core.verbose = false;
+    }
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    chrono::steady_clock::time_point next_tick = start;
+
+    for (size_t tick = 0; tick < frames.size(); tick++)
+    {
+        for (int camera = 0; camera < cameras; camera++)
+        {
+            struct LaneStream& stream = streams[camera];
+            FrameSlot* slot = stream.frames.begin_write();
+            if (!slot)
+            {
+                continue;
+            }
+
+            frames[(tick + camera * frames.size() / cameras) % frames.size()].copyTo(slot->image);
+            slot->stamp_ns = 0;
+            streams.commit_frame(stream, slot);
+        }
+
+        if (fps > 0.0)
+        {
+            next_tick += chrono::microseconds((long)(1000000.0 / fps));
+            this_thread::sleep_until(next_tick);
+        }
+    }
+
+    streams.stop();
+    double elapsed = elapsed_ms(start);
+
+    vector<struct LaneStreamStats> stats;
+    streams.get_stats(stats);
+    unsigned long detected = 0;
+
+    printf("Cameras: %d   worker threads: %d   feed: ", cameras, threads);
+    if (fps > 0.0)
+    {
+        printf("%.1f fps\n\n", fps);
+    }
+    else
+    {
+        printf("as fast as possible\n\n");
+    }
+    printf("%-10s %9s %9s %12s %9s %8s %10s %10s %10s %10s\n", "camera", "received", "dropped", "overwritten",
+           "detected", "fps", "mean ms", "p50 ms", "p95 ms", "p99 ms");
+
+    for (const struct LaneStreamStats& camera : stats)
+    {
+        printf("%-10s %9lu %9lu %12lu %9lu %8.1f %10.3f %10.3f %10.3f %10.3f\n", camera.name.c_str(),
+               camera.frames.committed, camera.frames.dropped, camera.frames.overwritten, camera.detected,
+               camera.detected * 1000.0 / elapsed, camera.latency.mean_ms, camera.latency.p50_ms,
+               camera.latency.p95_ms, camera.latency.p99_ms);
+        detected += camera.detected;
+    }
+
+    printf("%-10s %9s %9s %12s %9lu %8.1f\n", "total", "", "", "", detected, detected * 1000.0 / elapsed);
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Runs a recording made with the node's ~record_path through the lane core,
+ * reading every frame in place from the mapped file. Fast detects every
+ * frame back to back, so runs over the same recording detect the same
+ * frames and print the same pose checksum. Realtime keeps the recorded
+ * pace and, like the node, skips a frame whose camera already has a newer
+ * one due by the time the detector is free; how late a frame starts is
+ * charged to its wait stage. Every camera of a multi-camera recording has
+ * its own core and tracker.
+ */
+static int bench_replay(const FrameReplay& replay, bool realtime, const string& engine, int threads)
+{
+    size_t count = replay.size();
+    if (count == 0)
+    {
+        printf("The recording has no frames\n");
+        return EXIT_FAILURE;
+    }
+
+    if (realtime && replay.entry(0).stamp_ns == 0)
+    {
+        printf("The recording has no capture times, replaying as fast as possible\n");
+        realtime = false;
+    }
+
+    // next frame of the same camera, or count if it is the camera's last
+    int cameras = 0;
+    vector<size_t> next_of(count, count);
+    vector<size_t> last_of;
+    for (size_t frame = 0; frame < count; frame++)
+    {
+        int camera = replay.entry(frame).stream;
+        if (camera >= cameras)
+        {
+            cameras = camera + 1;
+            last_of.resize(cameras, count);
+        }
+        if (last_of[camera] < count)
+        {
+            next_of[last_of[camera]] = frame;
+        }
+        last_of[camera] = frame;
+    }
+
+    struct LaneParams params;
+    params.hough_threads = threads;
+    if (!params.set_lane_engine(engine))
+    {
+        printf("Unknown lane engine %s\n", engine.c_str());
+        return EXIT_FAILURE;
+    }
+
+    WorkerPool pool(max(0, threads - 1));
+    vector<LaneCore*> cores(cameras);
+    vector<struct LaneFilters> filters(cameras);
+    vector<struct LaneWorkspace> workspaces(cameras);
+    for (int camera = 0; camera < cameras; camera++)
+    {
+        cores[camera] = new LaneCore(&pool);
+        cores[camera]->verbose = false;
+        cores[camera]->params = params;
+        workspaces[camera].filters = &filters[camera];
+    }
+
+    LatencyHistogram stage_latency[NUM_LANE_STAGES];
+    LatencyHistogram frame_latency;
+    unsigned long detected = 0;
+    unsigned long skipped = 0;
+    unsigned long found = 0;
+    unsigned long checksum = 0;
+    unsigned long long first_stamp = replay.entry(0).stamp_ns;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    for (size_t frame = 0; frame < count; frame++)
+    {
+        const struct RecordedFrame& entry = replay.entry(frame);
+        double late_ms = 0.0;
+
+        if (realtime)
+        {
+            chrono::steady_clock::time_point due = start + chrono::nanoseconds(entry.stamp_ns - first_stamp);
+            size_t next = next_of[frame];
+
+            if (next < count && chrono::steady_clock::now() >=
+                start + chrono::nanoseconds(replay.entry(next).stamp_ns - first_stamp))
+            {
+                skipped++;
+                continue;
+            }
+
+            this_thread::sleep_until(due);
+            late_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - due).count();
+        }
+
+        LaneCore& core = *cores[entry.stream];
+        struct LaneWorkspace& work = workspaces[entry.stream];
+        work.sequence = entry.sequence;
+        work.stamp_ns = entry.stamp_ns;
+        core.prepare(replay.image(frame), work);
+        work.clock.add(STAGE_WAIT, late_ms);
+        core.detect(work);
+
+        for (int stage = 0; stage < NUM_LANE_STAGES; stage++)
+        {
+            if (work.clock.stage_ms[stage] > 0.0)
+            {
+                stage_latency[stage].record(work.clock.stage_ms[stage]);
+            }
+        }
+        frame_latency.record(work.clock.total_ms());
+
+        detected++;
+        found += work.pose.confidence > 0.0 ? 1 : 0;
+        checksum = checksum * 31 + (unsigned long)work.pose.center_offset;
+        checksum = checksum * 31 + (unsigned long)lround(work.pose.confidence * 1000.0);
+    }
+
+    double elapsed = elapsed_ms(start);
+    for (LaneCore* core : cores)
+    {
+        delete core;
+    }
+
+    printf("Engine: %s   threads: %d   cameras: %d   pace: %s\n", engine.c_str(), threads, cameras,
+           realtime ? "realtime" : "fast");
+    printf("Frames: %lu   detected: %lu   skipped: %lu   %.1f fps   lane found in %.1f%%\n", count, detected,
+           skipped, detected * 1000.0 / elapsed, found * 100.0 / max(detected, 1UL));
+    printf("Pose checksum: %016lx\n\n", checksum);
+    print_stage_latency(stage_latency, frame_latency);
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Runs the frames through the lane core once at the configured tuning and
+ * once under a QoS controller with the given deadline, after a warm-up
+ * pass, and compares deadline misses, detections and frame time. Reports
+ * how many frames ran at each QoS level.
+ */
+static int bench_qos(const vector<cv::Mat>& frames, double deadline_ms, const string& engine)
+{
+    struct LaneParams base;
+    if (!base.set_lane_engine(engine))
+    {
+        printf("Unknown lane engine %s\n", engine.c_str());
+        return EXIT_FAILURE;
+    }
+
+    if (!qos_supported(base))
+    {
+        printf("QoS levels do not change the %s engine\n", engine.c_str());
+        return EXIT_FAILURE;
+    }
+
+    WorkerPool pool(max(0, (int)sysconf(_SC_NPROCESSORS_ONLN) - 1));
+    base.hough_threads = pool.size() + 1;
+
+    printf("Engine: %s   deadline: %.1f ms\n\n", engine.c_str(), deadline_ms);
+    printf("%-8s %8s %8s %10s %10s %10s\n", "run", "frames", "missed", "found", "mean ms", "p99 ms");
+
+    struct QosStats stats;
+    const char* runs[] = { "warm-up", "fixed", "qos" };
+    for (int run = 0; run < 3; run++)
+    {
+        LaneCore core(&pool);
+        core.verbose = false;
+        core.params = base;
+
+        struct LaneFilters filters;
+        struct LaneWorkspace work;
+        work.filters = &filters;
+
+        QosController qos(deadline_ms);
+        LatencyHistogram frame_latency;
+        unsigned long missed = 0;
+        unsigned long found = 0;
+
+        for (size_t index = 0; index < frames.size(); index++)
+        {
+            work.sequence = index + 1;
+            core.prepare(frames[index], work);
+            core.detect(work);
+
+            double frame_ms = work.clock.total_ms();
+            frame_latency.record(frame_ms);
+            missed += frame_ms > deadline_ms ? 1 : 0;
+            found += work.pose.confidence > 0.0 ? 1 : 0;
+
+            // the next frame is prepared with the level the controller picked
+            if (run == 2 && qos.record(frame_ms, core.params.qos_level))
+            {
+                qos_params(base, qos.get_level(), core.params);
+            }
+        }
+
+        if (run == 0)
+        {
+            continue;
+        }
+
+        struct LatencySummary frame = frame_latency.summarize();
+        printf("%-8s %8lu %8lu %9.1f%% %10.3f %10.3f\n", runs[run], frames.size(), missed,
+               found * 100.0 / frames.size(), frame.mean_ms, frame.p99_ms);
+        stats = qos.get_stats();
+    }
+
+    printf("\nQoS level changes: %lu\n", stats.changes);
+    for (int level = 0; level < QOS_LEVELS; level++)
+    {
+        printf("  level %d %-16s %8lu frames\n", level, QOS_LEVEL_NAMES[level], stats.level_frames[level]);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static void print_usage()
+{
+    printf("Usage:\n"
+           "  lane_bench <command> <frames> [options]\n"
+           "\n"
+           "Description:\n"
+           "  Runs parts of the lane detector over recorded frames as fast as possible and\n"
+           "  reports how long they take. <frames> is a directory of images, read in file\n"
+           "  name order, or a video file. Frames wider than the reference width (%d px)\n"
+           "  are shrunk to it first, just like the node does. Everything is decoded before\n"
+           "  timing starts.\n"
+           "\n"
+           "Commands:\n"
+           "  prefilter <frames> [size]  - times every pre-filter kind against the original\n"
+           "                               color median path. size defaults to 25\n"
+           "  hough <frames> [threads]   - times Hough voting with 1 to threads threads and\n"
+           "                               checks they agree. threads defaults to the cores\n"
+           "  fixed <frames>             - times float against fixed-point Hough voting\n"
+           "                               and counts frames where their lines differ\n"
+           "  incremental <frames> [n]   - compares a full Hough vote per frame with votes\n"
+           "                               for changed edge pixels only, rebuilt every n\n"
+           "                               frames. n defaults to 30\n"
+           "  engines <frames>           - times the full resolution Hough engine against\n"
+           "                               the bird's eye engine\n"
+           "  pipeline <frames> [engine] [threads] [color|luma]\n"
+           "                             - runs the whole lane detector core and reports\n"
+           "                               frames per second and per stage latency. engine\n"
+           "                               is hough (default) or birds_eye. threads\n"
+           "                               defaults to the cores. luma feeds gray frames\n"
+           "                               like the node's luma only mode\n"
+           "  regress <frames> <labels> <baseline> [--update] [name=value ...]\n"
+           "                             - scores the detector with the given parameter\n"
+           "                               settings against labeled frames and fails if\n"
+           "                               detection rate, offset error or p95 latency\n"
+           "                               regress past the baseline's tolerances. labels\n"
+           "                               has lines of <frame index> <offset px | none>.\n"
+           "                               a missing baseline, or --update, records this\n"
+           "                               run as the baseline\n"
+           "  tune <frames> <labels> <sweep> <config> [threads]\n"
+           "                             - runs every combination of the settings in\n"
+           "                               sweep over the labeled frames, spread over\n"
+           "                               threads (default the cores), and writes the\n"
+           "                               Pareto front of accuracy against latency to\n"
+           "                               config for the node's ~tuned_config. sweep\n"
+           "                               has lines of <setting> <value> [value ...]\n"
+           "  streams <frames> [cameras] [threads] [fps]\n"
+           "                             - replays the frames into cameras cameras\n"
+           "                               (default 2) at fps (default 30, 0 as fast as\n"
+           "                               possible), detected on one shared pool of\n"
+           "                               threads workers (default the cores), and\n"
+           "                               reports frames and latency per camera\n"
+           "  strips <frames> [threads]  - times strip-tiled gray, pre-filter and Canny for\n"
+           "                               a range of strip heights against full image\n"
+           "                               passes. threads defaults to OpenCV's choice\n"
+           "  qos <frames> [deadline ms] [engine]\n"
+           "                             - runs the detector core at its configured\n"
+           "                               tuning and under the QoS controller with the\n"
+           "                               deadline (default 33 ms) and compares missed\n"
+           "                               deadlines, detections and frame time\n"
+           "  replay <recording> [fast|realtime] [engine] [threads]\n"
+           "                             - runs a recording made with the node's\n"
+           "                               ~record_path through the detector core,\n"
+           "                               reading frames in place from the file. fast\n"
+           "                               (default) detects every frame and prints a\n"
+           "                               pose checksum to compare runs. realtime keeps\n"
+           "                               the recorded pace and skips frames the\n"
+           "                               detector is too slow for\n"
+           "  --help                     - displays this help message and exits\n",
+           LANE_REFERENCE_WIDTH);
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc > 1 && strcmp(argv[1], "--help") == 0)
+    {
+        print_usage();
+        return EXIT_SUCCESS;
+    }
+
+    if (argc < 3)
+    {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+
+    string command = argv[1];
+    vector<cv::Mat> frames;
+
+    // recordings are read in place instead of being decoded up front
+    if (command == "replay")
+    {
+        string pace = argc > 3 ? argv[3] : "fast";
+        string engine = argc > 4 ? argv[4] : LANE_ENGINE_NAMES[LANE_ENGINE_HOUGH];
+        int threads = argc > 5 ? atoi(argv[5]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+        try
+        {
+            FrameReplay replay(argv[2]);
+            return bench_replay(replay, pace == "realtime", engine, max(1, threads));
+        }
+        catch (exception& exc)
+        {
+            printf("%s\nExiting\n", exc.what());
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (!load_frames(argv[2], frames, LANE_REFERENCE_WIDTH))
+    {
+        printf("No frames loaded from %s. Exiting\n", argv[2]);
+        return EXIT_FAILURE;
+    }
+
+    printf("Loaded %lu frames of %dx%d\n\n", frames.size(), frames[0].cols, frames[0].rows);
+
+    if (command == "prefilter")
+    {
+        int size = argc > 3 ? atoi(argv[3]) : 25;
+        return bench_prefilter(frames, size);
+    }
+    else if (command == "hough")
+    {
+        int max_threads = argc > 3 ? atoi(argv[3]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+        return bench_hough(frames, max(1, max_threads));
+    }
+    else if (command == "fixed")
+    {
+        return bench_fixed(frames);
+    }
+    else if (command == "incremental")
+    {
+        int rebuild_interval = argc > 3 ? atoi(argv[3]) : 30;
+        return bench_incremental(frames, rebuild_interval);
+    }
+    else if (command == "engines")
+    {
+        return bench_engines(frames);
+    }
+    else if (command == "pipeline")
+    {
+        string engine = argc > 3 ? argv[3] : LANE_ENGINE_NAMES[LANE_ENGINE_HOUGH];
+        int threads = argc > 4 ? atoi(argv[4]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+        bool luma = argc > 5 && strcmp(argv[5], "luma") == 0;
+        return bench_pipeline(frames, engine, max(1, threads), luma);
+    }
+    else if (command == "regress")
+    {
+        if (argc < 5)
+        {
+            print_usage();
+            return EXIT_FAILURE;
+        }
+
+        vector<string> options(argv + 5, argv + argc);
+        return bench_regress(frames, argv[3], argv[4], options);
+    }
+    else if (command == "tune")
+    {
+        if (argc < 6)
+        {
+            print_usage();
+            return EXIT_FAILURE;
+        }
+
+        int threads = argc > 6 ? atoi(argv[6]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+        return bench_tune(frames, argv[3], argv[4], argv[5], max(1, threads));
+    }
+    else if (command == "streams")
+    {
+        int cameras = argc > 3 ? atoi(argv[3]) : 2;
+        int threads = argc > 4 ? atoi(argv[4]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+        double fps = argc > 5 ? atof(argv[5]) : 30.0;
+        return bench_streams(frames, max(1, cameras), max(1, threads), max(0.0, fps));
+    }
+    else if (command == "qos")
+    {
+        double deadline_ms = argc > 3 ? atof(argv[3]) : 33.0;
+        string engine = argc > 4 ? argv[4] : LANE_ENGINE_NAMES[LANE_ENGINE_HOUGH];
+        return bench_qos(frames, max(1.0, deadline_ms), engine);
+    }
+    else if (command == "strips")
+    {
+        int threads = argc > 3 ? atoi(argv[3]) : 0;
+        return bench_strips(frames, threads);
+    }
+
+    printf("Unknown command %s\n\n", command.c_str());
+    print_usage();
+    return EXIT_FAILURE;
+}
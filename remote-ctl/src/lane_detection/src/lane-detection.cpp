@@ -2,6 +2,7 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cmath>
+#include <algorithm>
 #include <vector>
 #include <string>
 #include <sys/time.h>
@@ -30,6 +31,84 @@ int main(int argc, char* argv[])
     printf("Lane detector. Now publishing output\n");
 
     detector->lane_guidance();
+
+    struct FramePoolStats stats = detector->get_frame_stats();
+    printf("Frames received: %lu   dropped: %lu   overwritten before processing: %lu   stale: %lu\n",
+           stats.committed, stats.dropped, stats.overwritten, stats.stale);
+
+    struct PipelineStageStats stages[NUM_PIPELINE_STAGES];
+    if (detector->get_pipeline_stats(stages))
+    {
+        printf("Pipeline stage   frames   busy ms/frame   stall ms/frame   mean depth   max depth\n");
+        for (int stage = 0; stage < NUM_PIPELINE_STAGES; stage++)
+        {
+            double frames = (double)max(stages[stage].frames, 1UL);
+            printf("  %-12s %8lu %15.2f %16.2f %12.2f %11lu\n",
+                   PIPELINE_STAGE_NAMES[stage], stages[stage].frames, stages[stage].busy_ms / frames,
+                   stages[stage].stall_ms / frames, stages[stage].mean_depth, stages[stage].max_depth);
+        }
+    }
+
+    struct ReorderStats reorder;
+    if (detector->get_reorder_stats(reorder))
+    {
+        printf("Frame-parallel frames started: %lu   published: %lu   superseded: %lu\n",
+               reorder.started, reorder.published, reorder.superseded);
+    }
+
+    struct DebugWriterStats debug;
+    if (detector->get_debug_stats(debug))
+    {
+        printf("Debug frames queued: %lu   written: %lu   dropped: %lu\n",
+               debug.queued, debug.written, debug.dropped);
+    }
+
+    struct QosStats qos;
+    if (detector->get_qos_stats(qos))
+    {
+        printf("Frames over deadline: %lu of %lu   QoS level changes: %lu\n", qos.missed, qos.frames, qos.changes);
+        for (int level = 0; level < QOS_LEVELS; level++)
+        {
+            printf("  level %d %-16s %9lu frames\n", level, QOS_LEVEL_NAMES[level], qos.level_frames[level]);
+        }
+    }
+
+    struct RecordingStats recording;
+    if (detector->get_recording_stats(recording))
+    {
+        printf("Frames recorded: %lu   dropped: %lu   size: %.1f MB\n", recording.recorded, recording.dropped,
+               recording.bytes / 1048576.0);
+    }
+
+    vector<struct LaneStreamStats> cameras;
+    if (detector->get_camera_stats(cameras))
+    {
+        printf("Camera          received    dropped    detected    stale    mean ms     p95 ms     p99 ms\n");
+        for (const struct LaneStreamStats& camera : cameras)
+        {
+            printf("  %-12s %9lu %10lu %11lu %8lu %10.2f %10.2f %10.2f\n", camera.name.c_str(),
+                   camera.frames.committed, camera.frames.dropped, camera.detected, camera.frames.stale,
+                   camera.latency.mean_ms, camera.latency.p95_ms, camera.latency.p99_ms);
+        }
+    }
+
+    struct LatencySummary latency[NUM_LANE_STAGES];
+    struct LatencySummary frame_latency;
+    detector->get_latency(latency, frame_latency);
+    printf("Stage latency     frames    mean ms     p50 ms     p95 ms     p99 ms     max ms\n");
+    for (int stage = 0; stage < NUM_LANE_STAGES; stage++)
+    {
+        if (latency[stage].count > 0)
+        {
+            printf("  %-12s %9lu %10.2f %10.2f %10.2f %10.2f %10.2f\n", LANE_STAGE_NAMES[stage],
+                   latency[stage].count, latency[stage].mean_ms, latency[stage].p50_ms, latency[stage].p95_ms,
+                   latency[stage].p99_ms, latency[stage].max_ms);
+        }
+    }
+    printf("  %-12s %9lu %10.2f %10.2f %10.2f %10.2f %10.2f\n", "total", frame_latency.count,
+           frame_latency.mean_ms, frame_latency.p50_ms, frame_latency.p95_ms, frame_latency.p99_ms,
+           frame_latency.max_ms);
+
     delete detector;
 
     return EXIT_SUCCESS;